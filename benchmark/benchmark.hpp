@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2026, Nils Christopher Brause, Philipp Kerling
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WAYLANDPP_BENCHMARK_HPP
+#define WAYLANDPP_BENCHMARK_HPP
+
+/*
+ * Helpers shared by the benchmarks. Every benchmark is a single
+ * translation unit, which includes this header exactly once: it replaces
+ * the global operator new to count heap allocations.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace benchmark
+{
+  std::atomic<std::size_t> allocations{0};
+
+  // Run func the given number of times and print allocations and time per iteration
+  template <typename F>
+  void measure(const std::string &name, const std::string &unit, unsigned int iterations, F func)
+  {
+    // warm up
+    func();
+
+    std::size_t before = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned int i = 0; i < iterations; i++)
+      func();
+    auto end = std::chrono::steady_clock::now();
+    std::size_t after = allocations.load();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::cout << name << ": "
+              << static_cast<double>(after - before) / iterations << " allocations/" << unit << ", "
+              << ns / iterations << " ns/" << unit << ", "
+              << 1e9 * iterations / ns << " " << unit << "s/s" << std::endl;
+  }
+
+  // Print percentiles of the given latency samples in nanoseconds
+  void report_percentiles(const std::string &name, std::vector<double> samples)
+  {
+    if(samples.empty())
+      return;
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&] (double p)
+    {
+      return samples[static_cast<std::size_t>(p * static_cast<double>(samples.size() - 1))] / 1000.0;
+    };
+    std::cout << name << ": "
+              << "p50 " << percentile(0.5) << " us, "
+              << "p90 " << percentile(0.9) << " us, "
+              << "p99 " << percentile(0.99) << " us, "
+              << "max " << samples.back() / 1000.0 << " us" << std::endl;
+  }
+
+  // Print the throughput of count items processed in ns nanoseconds
+  void report_throughput(const std::string &name, const std::string &unit, std::size_t count, double ns)
+  {
+    std::cout << name << ": " << 1e9 * static_cast<double>(count) / ns << " " << unit << "s/s, "
+              << ns / static_cast<double>(count) << " ns/" << unit << std::endl;
+  }
+}
+
+void *operator new(std::size_t size)
+{
+  benchmark::allocations.fetch_add(1, std::memory_order_relaxed);
+  if(void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t /*unused*/) noexcept
+{
+  std::free(p);
+}
+
+#endif
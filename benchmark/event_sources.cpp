@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2026, Nils Christopher Brause, Philipp Kerling
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Soak test for the callback storage of event_loop_t: adds and removes a
+ * million idle sources and timers, the way a compositor creates an idle
+ * source per repaint and a timer per key repeat, and prints the resident
+ * set size along the way. It is expected to stay flat, as the dispatch
+ * function of a source is freed together with the source.
+ * Also compares re-arming a timer source with restarting one of many
+ * timers of a timer_wheel_t.
+ */
+
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <unistd.h>
+
+#include <wayland-server.hpp>
+
+#include "benchmark.hpp"
+
+namespace
+{
+  constexpr unsigned int sources = 1000000;
+  constexpr unsigned int reports = 10;
+  constexpr unsigned int wheel_timers = 10000;
+
+  // Resident set size in KiB
+  std::size_t rss()
+  {
+    std::ifstream statm("/proc/self/statm");
+    std::size_t size = 0;
+    std::size_t resident = 0;
+    statm >> size >> resident;
+    return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE)) / 1024;
+  }
+}
+
+int main()
+{
+  wayland::server::event_loop_t loop;
+  std::size_t dispatched = 0;
+  auto idle_cycle = [&] ()
+  {
+    auto idle = loop.add_idle([&] () { dispatched++; });
+    loop.dispatch_idle();
+  };
+
+  benchmark::measure("idle source add/dispatch/remove", "source", sources, idle_cycle);
+  benchmark::measure("timer add/arm/remove", "source", sources, [&] ()
+  {
+    auto timer = loop.add_timer([] () { return 0; });
+    timer.timer_update(1000);
+  });
+
+  auto timer = loop.add_timer([] () { return 0; });
+  unsigned int delay = 0;
+  benchmark::measure("timer source re-arm", "re-arm", sources, [&] ()
+  {
+    timer.timer_update(static_cast<int>(1000 + delay++ % 1000));
+  });
+  timer.timer_update(0);
+
+  wayland::server::timer_wheel_t wheel(loop);
+  std::vector<wayland::server::wheel_timer_t> timers;
+  for(unsigned int c = 0; c < wheel_timers; c++)
+    timers.push_back(wheel.add_timer([] () {}));
+  unsigned int next = 0;
+  benchmark::measure("timer wheel restart", "re-arm", sources, [&] ()
+  {
+    timers[next++ % wheel_timers].start(1000 + delay++ % 1000);
+  });
+
+  std::cout << "RSS before: " << rss() << " KiB" << std::endl;
+  for(unsigned int c = 0; c < reports; c++)
+  {
+    for(unsigned int s = 0; s < sources / reports; s++)
+      idle_cycle();
+    std::cout << "RSS after " << (c + 1) * (sources / reports) << " idle sources: " << rss() << " KiB" << std::endl;
+  }
+
+  // warm up of measure() included
+  if(dispatched != 2 * sources + 1)
+  {
+    std::cerr << "Idle sources were not dispatched." << std::endl;
+    return 1;
+  }
+  return 0;
+}
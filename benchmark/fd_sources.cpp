@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2026, Nils Christopher Brause, Philipp Kerling
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compares the epoll set of the event loop with io_uring_backend_t for
+ * many file descriptor sources. Every round writes one byte into each of
+ * a number of socketpairs and dispatches the event loop until all of
+ * them have been read, and then switches the sources to writable and
+ * back, as a server would do while flushing. The io_uring part is skipped
+ * if it is not available.
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <wayland-server.hpp>
+
+#include "benchmark.hpp"
+
+namespace
+{
+  constexpr unsigned int pairs = 256;
+  constexpr unsigned int rounds = 2000;
+
+  struct socketpairs_t
+  {
+    std::vector<int> server;
+    std::vector<int> client;
+
+    socketpairs_t()
+    {
+      for(unsigned int c = 0; c < pairs; c++)
+      {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, fds) < 0)
+          throw std::runtime_error("socketpair failed.");
+        server.push_back(fds[0]);
+        client.push_back(fds[1]);
+      }
+    }
+
+    ~socketpairs_t()
+    {
+      for(int fd : server)
+        close(fd);
+      for(int fd : client)
+        close(fd);
+    }
+
+    socketpairs_t(const socketpairs_t&) = delete;
+    socketpairs_t &operator=(const socketpairs_t&) = delete;
+  };
+
+  // Read everything a client sent, and count the reads
+  int read_func(int fd, uint32_t mask, unsigned int &received)
+  {
+    if(mask & WL_EVENT_READABLE)
+    {
+      char buffer[64];
+      while(read(fd, buffer, sizeof(buffer)) > 0)
+        received++;
+    }
+    return 0;
+  }
+
+  // Write to all clients and dispatch until the server side has read everything
+  template <typename S>
+  void run(const std::string &name, wayland::server::event_loop_t &loop, socketpairs_t &sockets, std::vector<S> &sources,
+           unsigned int &received)
+  {
+    auto round = [&] ()
+    {
+      received = 0;
+      for(int fd : sockets.client)
+        if(write(fd, "x", 1) != 1)
+          throw std::runtime_error("write failed.");
+      while(received < pairs)
+        if(loop.dispatch(-1) < 0)
+          throw std::runtime_error("dispatch failed.");
+      // Watch for writability for a moment, like a server with a full socket buffer
+      for(auto &source : sources)
+        source.fd_update(WL_EVENT_READABLE | WL_EVENT_WRITABLE);
+      for(auto &source : sources)
+        source.fd_update(WL_EVENT_READABLE);
+    };
+    benchmark::measure(name, "round", rounds, round);
+  }
+}
+
+int main()
+{
+  wayland::server::event_loop_t loop;
+  socketpairs_t sockets;
+  unsigned int received = 0;
+  auto func = [&] (int fd, uint32_t mask) { return read_func(fd, mask, received); };
+
+  {
+    std::vector<wayland::server::event_source_t> sources;
+    for(int fd : sockets.server)
+      sources.push_back(loop.add_fd(fd, WL_EVENT_READABLE, func));
+    run("epoll, " + std::to_string(pairs) + " sockets", loop, sockets, sources, received);
+  }
+
+  if(!wayland::server::io_uring_backend_t::available())
+  {
+    std::cout << "io_uring is not available." << std::endl;
+    return 0;
+  }
+
+  wayland::server::io_uring_backend_t backend(loop);
+  std::vector<wayland::server::io_uring_source_t> sources;
+  for(int fd : sockets.server)
+    sources.push_back(backend.add_fd(fd, WL_EVENT_READABLE, func));
+  run("io_uring, " + std::to_string(pairs) + " sockets", loop, sockets, sources, received);
+  return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2026, Nils Christopher Brause, Philipp Kerling
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs a server and a client display in one process, connected through a
+ * socketpair(), and measures:
+ *  - wl_display.sync and pingpong round trip latency percentiles, the
+ *    latter also with display_t::pump() driven by poll(), and while the
+ *    server runs expensive requests on a worker_pool_t,
+ *  - request throughput and heap allocations per request of a
+ *    wl_surface.damage_buffer/commit mix, marshalled through libwayland,
+ *  - event throughput and heap allocations per event of
+ *    wl_pointer.motion/frame and enter/leave bursts, the latter carrying an
+ *    object argument,
+ *  - heap allocations and time per created and destroyed object, for
+ *    surfaces and regions created every frame.
+ * Pass --system-allocator to bypass the object pool of the libraries.
+ * If the libraries are built with WAYLANDPP_REFCOUNT_STATISTICS defined,
+ * the proxy reference count operations per event are reported as well.
+ * Expect 2 per event for motion/frame, the reference held on the target
+ * during the handler, and 4 for enter/leave, whose wl_surface argument is
+ * an owning surface_t because handlers take their wrappers by value.
+ * The server dispatches its event loop in a separate thread.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <wayland-client.hpp>
+#include <wayland-server.hpp>
+#include <wayland-server-protocol.hpp>
+#include <pingpong-client-protocol.hpp>
+#include <pingpong-server-protocol.hpp>
+
+#include "benchmark.hpp"
+
+namespace
+{
+  constexpr unsigned int roundtrips = 10000;
+  constexpr unsigned int request_batches = 1000;
+  constexpr unsigned int requests_per_batch = 500;
+  constexpr unsigned int event_bursts = 1000;
+  // motion and frame pairs per burst, small enough to fit into the socket buffer
+  constexpr unsigned int events_per_burst = 500;
+  constexpr unsigned int object_frames = 1000;
+  // surfaces and regions created per frame
+  constexpr unsigned int objects_per_frame = 50;
+  // duration of the work triggered by each "heavy" ping
+  constexpr std::chrono::microseconds heavy_work{500};
+
+  using clock = std::chrono::steady_clock;
+
+  double elapsed_ns(clock::time_point start)
+  {
+    return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+  }
+
+  void dispatch_until(wayland::display_t &display, const bool &done)
+  {
+    while(!done)
+      if(display.dispatch() < 0)
+        throw std::runtime_error("Client dispatch failed.");
+  }
+
+  // The way an external event loop would drive the display
+  void pump_until(wayland::display_t &display, const bool &done)
+  {
+    auto result = display.pump(false, false);
+    while(!done)
+    {
+      pollfd fd = {display.get_fd(), static_cast<short>(POLLIN | (result.want_write ? POLLOUT : 0)), 0};
+      if(poll(&fd, 1, -1) < 0)
+        throw std::runtime_error("poll failed.");
+      result = display.pump(fd.revents & (POLLIN | POLLERR | POLLHUP), fd.revents & POLLOUT);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  // Has to happen before the first object is created.
+  if(argc > 1 && std::strcmp(argv[1], "--system-allocator") == 0)
+    wayland::set_object_allocator({[] (std::size_t size) { return ::operator new(size); },
+                                   [] (void *ptr, std::size_t /*size*/) { ::operator delete(ptr); }});
+
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+  {
+    std::cerr << "socketpair failed." << std::endl;
+    return 1;
+  }
+
+  // Server side
+  wayland::server::display_t server_display;
+  wayland::server::global_pingpong_t global_pingpong(server_display);
+  wayland::server::global_compositor_t global_compositor(server_display);
+  wayland::server::global_seat_t global_seat(server_display);
+
+  // Run "heavy" pings on two threads, answering from the event loop once done.
+  wayland::server::worker_pool_t workers(server_display.get_event_loop(), 2);
+
+  // Don't copy resources into their own event handlers as this creates cyclic references.
+  wayland::server::pingpong_t server_pingpong;
+  wayland::server::compositor_t server_compositor;
+  wayland::server::surface_t server_surface;
+  wayland::server::seat_t server_seat;
+  wayland::server::pointer_t server_pointer;
+  std::atomic<std::size_t> requests_received{0};
+
+  global_pingpong.on_bind() = [&] (const wayland::server::client_t& /*client*/, wayland::server::pingpong_t pingpong)
+  {
+    server_pingpong = pingpong;
+    pingpong.on_ping() = [&] (const std::string& msg)
+    {
+      if(msg == "heavy")
+      {
+        wayland::server::weak_resource_t<wayland::server::pingpong_t> weak(server_pingpong);
+        workers.post([] ()
+        {
+          auto end = clock::now() + heavy_work;
+          while(clock::now() < end)
+            ;
+        }, [weak] ()
+        {
+          auto pingpong = weak.lock();
+          if(pingpong)
+            pingpong.pong("heavy");
+        });
+        return;
+      }
+      // "motion" and "enter" pings ask for pointer events before the answer.
+      if(msg == "motion")
+        for(unsigned int c = 0; c < events_per_burst; c++)
+        {
+          server_pointer.motion(c, 1.5, 2.5);
+          server_pointer.frame();
+        }
+      else if(msg == "enter")
+        for(unsigned int c = 0; c < events_per_burst; c++)
+        {
+          server_pointer.enter(c, server_surface, 1.5, 2.5);
+          server_pointer.leave(c, server_surface);
+        }
+      server_pingpong.pong(msg);
+    };
+  };
+
+  global_compositor.on_bind() = [&] (const wayland::server::client_t& /*client*/, wayland::server::compositor_t compositor)
+  {
+    server_compositor = compositor;
+    compositor.on_create_surface() = [&] (wayland::server::surface_t surface)
+    {
+      server_surface = surface;
+      surface.on_damage_buffer() = [&] (int32_t /*x*/, int32_t /*y*/, int32_t /*width*/, int32_t /*height*/)
+      {
+        requests_received++;
+      };
+      surface.on_commit() = [&] ()
+      {
+        requests_received++;
+      };
+    };
+  };
+
+  global_seat.on_bind() = [&] (const wayland::server::client_t& /*client*/, wayland::server::seat_t seat)
+  {
+    server_seat = seat;
+    seat.capabilities(wayland::server::seat_capability::pointer);
+    seat.on_get_pointer() = [&] (wayland::server::pointer_t pointer)
+    {
+      server_pointer = pointer;
+    };
+  };
+
+  wayland::server::client_t server_client(server_display, fds[0]);
+
+  // Run server event loop in a thread.
+  std::atomic<bool> running{true};
+  auto thread = std::thread([&] ()
+  {
+    auto el = server_display.get_event_loop();
+    while(running)
+    {
+      el.dispatch(1);
+      server_display.flush_clients();
+    }
+  });
+
+  int result = 0;
+  try
+  {
+    // Client side
+    wayland::display_t display(fds[1]);
+    wayland::pingpong_t pingpong;
+    wayland::compositor_t compositor;
+    wayland::seat_t seat;
+
+    auto registry = display.get_registry();
+    registry.on_global() = [&] (uint32_t name, const std::string& interface, uint32_t version)
+    {
+      if(interface == wayland::pingpong_t::interface_name)
+        registry.bind(name, pingpong, std::min(wayland::pingpong_t::interface_version, version));
+      else if(interface == wayland::compositor_t::interface_name)
+        registry.bind(name, compositor, std::min(wayland::compositor_t::interface_version, version));
+      else if(interface == wayland::seat_t::interface_name)
+        registry.bind(name, seat, std::min(wayland::seat_t::interface_version, version));
+    };
+    display.roundtrip();
+    if(!pingpong || !compositor || !seat)
+      throw std::runtime_error("Server globals not found.");
+
+    auto surface = compositor.create_surface();
+    if(!surface.can_damage_buffer())
+      throw std::runtime_error("wl_surface.damage_buffer not supported.");
+    auto pointer = seat.get_pointer();
+    std::size_t events_received = 0;
+    pointer.on_motion() = [&] (uint32_t /*time*/, double /*x*/, double /*y*/) { events_received++; };
+    pointer.on_frame() = [&] () { events_received++; };
+    pointer.on_enter() = [&] (uint32_t /*serial*/, wayland::surface_t /*surface*/, double /*x*/, double /*y*/) { events_received++; };
+    pointer.on_leave() = [&] (uint32_t /*serial*/, wayland::surface_t /*surface*/) { events_received++; };
+    bool pong = false;
+    unsigned int heavy_pongs = 0;
+    pingpong.on_pong() = [&] (const std::string& msg)
+    {
+      if(msg == "heavy")
+        heavy_pongs++;
+      else
+        pong = true;
+    };
+    display.roundtrip();
+
+    // Round trip latency
+    std::vector<double> samples;
+    samples.reserve(roundtrips);
+    for(unsigned int c = 0; c < roundtrips; c++)
+    {
+      auto start = clock::now();
+      display.roundtrip();
+      samples.push_back(elapsed_ns(start));
+    }
+    benchmark::report_percentiles("wl_display.sync round trip", samples);
+
+    samples.clear();
+    for(unsigned int c = 0; c < roundtrips; c++)
+    {
+      auto start = clock::now();
+      pong = false;
+      pingpong.ping("ping");
+      display.flush();
+      dispatch_until(display, pong);
+      samples.push_back(elapsed_ns(start));
+    }
+    benchmark::report_percentiles("pingpong round trip", samples);
+
+    samples.clear();
+    for(unsigned int c = 0; c < roundtrips; c++)
+    {
+      auto start = clock::now();
+      pong = false;
+      pingpong.ping("ping");
+      pump_until(display, pong);
+      samples.push_back(elapsed_ns(start));
+    }
+    display.pump_release();
+    benchmark::report_percentiles("pingpong round trip (pump)", samples);
+
+    // Each ping follows a ping whose work takes longer than the round trip.
+    samples.clear();
+    for(unsigned int c = 0; c < roundtrips; c++)
+    {
+      pingpong.ping("heavy");
+      auto start = clock::now();
+      pong = false;
+      pingpong.ping("ping");
+      display.flush();
+      dispatch_until(display, pong);
+      samples.push_back(elapsed_ns(start));
+    }
+    while(heavy_pongs < roundtrips)
+      if(display.dispatch() < 0)
+        throw std::runtime_error("Client dispatch failed.");
+    benchmark::report_percentiles("pingpong round trip (worker pool busy)", samples);
+
+    // Request throughput
+    std::size_t requests_before = requests_received;
+    std::size_t request_allocations = benchmark::allocations;
+    auto start = clock::now();
+    for(unsigned int c = 0; c < request_batches; c++)
+    {
+      for(unsigned int r = 0; r < requests_per_batch / 2; r++)
+      {
+        surface.damage_buffer(0, 0, 64, 64);
+        surface.commit();
+      }
+      display.roundtrip();
+    }
+    double ns = elapsed_ns(start);
+    // includes the wl_display.sync round trip closing every batch
+    request_allocations = benchmark::allocations - request_allocations;
+    if(requests_received - requests_before != request_batches * (requests_per_batch / 2) * 2)
+      throw std::runtime_error("Server missed requests.");
+    benchmark::report_throughput("wl_surface.damage_buffer/commit", "request", requests_received - requests_before, ns);
+    std::cout << "wl_surface.damage_buffer/commit: "
+              << static_cast<double>(request_allocations) / static_cast<double>(requests_received - requests_before)
+              << " allocations/request" << std::endl;
+
+    // Event throughput
+    auto event_bursts_for = [&] (const std::string &name, const std::string &message)
+    {
+      events_received = 0;
+      std::size_t operations = wayland::detail::refcount_t::operations();
+      std::size_t allocations = benchmark::allocations;
+      auto start = clock::now();
+      for(unsigned int c = 0; c < event_bursts; c++)
+      {
+        pong = false;
+        pingpong.ping(message);
+        display.flush();
+        dispatch_until(display, pong);
+      }
+      double ns = elapsed_ns(start);
+      // includes the ping and pong framing every burst
+      allocations = benchmark::allocations - allocations;
+      operations = wayland::detail::refcount_t::operations() - operations;
+      if(events_received != event_bursts * events_per_burst * 2)
+        throw std::runtime_error("Client missed events.");
+      benchmark::report_throughput(name, "event", events_received, ns);
+      std::cout << name << ": " << static_cast<double>(allocations) / static_cast<double>(events_received)
+                << " allocations/event" << std::endl;
+#ifdef WAYLANDPP_REFCOUNT_STATISTICS
+      std::cout << name << ": " << static_cast<double>(operations) / static_cast<double>(events_received)
+                << " refcount operations/event" << std::endl;
+#endif
+    };
+    event_bursts_for("wl_pointer.motion/frame", "motion");
+    event_bursts_for("wl_pointer.enter/leave", "enter");
+
+    // Object churn, counting the allocations of both the client and the server
+    // side. libwayland itself does not allocate through operator new.
+    auto create_objects = [&] ()
+    {
+      for(unsigned int c = 0; c < objects_per_frame; c++)
+      {
+        auto frame_surface = compositor.create_surface();
+        auto frame_region = compositor.create_region();
+        frame_region.add(0, 0, 64, 64);
+        frame_surface.set_input_region(frame_region);
+      }
+      display.roundtrip();
+    };
+    create_objects(); // warm up
+    std::size_t allocations = benchmark::allocations;
+    start = clock::now();
+    for(unsigned int c = 0; c < object_frames; c++)
+      create_objects();
+    ns = elapsed_ns(start);
+    allocations = benchmark::allocations - allocations;
+    std::size_t objects = object_frames * objects_per_frame * 2;
+    std::cout << "wl_surface/wl_region create and destroy: "
+              << static_cast<double>(allocations) / static_cast<double>(objects) << " allocations/object, "
+              << ns / static_cast<double>(objects) << " ns/object" << std::endl;
+  }
+  catch(std::exception &e)
+  {
+    std::cerr << e.what() << std::endl;
+    result = 1;
+  }
+
+  running = false;
+  thread.join();
+  return result;
+}
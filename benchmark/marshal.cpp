@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2026, Nils Christopher Brause, Philipp Kerling
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compares the request marshalling paths of proxy_t: the former one, which
+ * built a std::vector<argument_t> and then a std::vector<wl_argument> for
+ * every request, and the current one, which converts the arguments into a
+ * std::array<wl_argument, N> on the stack. The wl_argument array is handed
+ * to a sink instead of libwayland, so only the cost of building the
+ * arguments is measured. The loopback benchmark measures the request
+ * throughput through libwayland.
+ */
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <wayland-util.hpp>
+
+#include "benchmark.hpp"
+
+using wayland::detail::argument_t;
+using wayland::detail::wire_argument;
+
+namespace
+{
+  constexpr unsigned int iterations = 1000000;
+
+  volatile uint32_t sink_value = 0;
+
+  // stands in for wl_proxy_marshal_array
+  __attribute__((noinline)) void sink(const wl_argument *args, std::size_t count)
+  {
+    for(std::size_t c = 0; c < count; c++)
+      sink_value = sink_value + args[c].u;
+  }
+
+  template <typename...T>
+  void marshal_vector(const T& ...args)
+  {
+    std::vector<argument_t> v = { argument_t(args)... };
+    std::vector<wl_argument> w;
+    w.reserve(v.size());
+    for(auto const& arg : v)
+      w.push_back(arg.get_c_argument());
+    sink(w.data(), w.size());
+  }
+
+  template <typename...T>
+  void marshal_stack(const T& ...args)
+  {
+    std::array<wl_argument, sizeof...(T)> v = {{ wire_argument(args)... }};
+    sink(v.data(), v.size());
+  }
+}
+
+int main()
+{
+  auto *buffer = reinterpret_cast<wl_object*>(0x1000);
+  std::string title = "waylandpp benchmark";
+  std::vector<uint32_t> raw_keys{30, 31, 32};
+  wayland::array_t keys = raw_keys;
+
+  benchmark::measure("wl_surface.attach (vector)", "request", iterations, [&] { marshal_vector(buffer, 0, 0); });
+  benchmark::measure("wl_surface.attach (stack)", "request", iterations, [&] { marshal_stack(buffer, 0, 0); });
+
+  benchmark::measure("wl_surface.damage_buffer (vector)", "request", iterations, [&] { marshal_vector(0, 0, 640, 480); });
+  benchmark::measure("wl_surface.damage_buffer (stack)", "request", iterations, [&] { marshal_stack(0, 0, 640, 480); });
+
+  benchmark::measure("wl_surface.commit (vector)", "request", iterations, [&] { marshal_vector(); });
+  benchmark::measure("wl_surface.commit (stack)", "request", iterations, [&] { marshal_stack(); });
+
+  benchmark::measure("xdg_toplevel.set_title (vector)", "request", iterations, [&] { marshal_vector(title); });
+  benchmark::measure("xdg_toplevel.set_title (stack)", "request", iterations, [&] { marshal_stack(title); });
+
+  benchmark::measure("array request (vector)", "request", iterations, [&] { marshal_vector(keys); });
+  benchmark::measure("array request (stack)", "request", iterations, [&] { marshal_stack(keys); });
+  benchmark::measure("array request (borrowed vector)", "request", iterations, [&] { marshal_stack(wayland::array_view_t<>(raw_keys)); });
+
+  return 0;
+}
@@ -5,6 +5,7 @@ set(PROTO_FILES
 generate_cpp_client_files("${PROTO_XMLS}" "${PROTO_FILES}" "" "")
 set(WAYLAND_CLIENT_HEADERS
   "include/wayland-client.hpp"
+  "include/wayland-client-coroutine.hpp"
   "include/wayland-util.hpp"
   "${CMAKE_CURRENT_BINARY_DIR}/wayland-client-protocol.hpp"
   "${CMAKE_CURRENT_BINARY_DIR}/wayland-version.hpp")
@@ -16,6 +17,9 @@ define_library(wayland-client++
   src/wayland-util.cpp
   wayland-client-protocol.cpp
   wayland-client-protocol.hpp)
+# queue_dispatcher_t runs its own threads
+find_package(Threads REQUIRED)
+target_link_libraries(wayland-client++ PRIVATE Threads::Threads)
 # Report undefined references only for the base library.
 if(${CMAKE_VERSION} VERSION_GREATER "3.14.0")
   target_link_options(wayland-client++ PRIVATE "-Wl,--no-undefined")
@@ -15,6 +15,17 @@ define_library(wayland-server++
   src/wayland-util.cpp
   wayland-server-protocol.cpp
   wayland-server-protocol.hpp)
+# worker_pool_t runs its own threads
+find_package(Threads REQUIRED)
+target_link_libraries(wayland-server++ PRIVATE Threads::Threads)
+if(IO_URING_BACKEND)
+  include(CheckIncludeFile)
+  check_include_file("linux/io_uring.h" HAVE_LINUX_IO_URING_H)
+  if(NOT HAVE_LINUX_IO_URING_H)
+    message(FATAL_ERROR "IO_URING_BACKEND requires linux/io_uring.h")
+  endif()
+  target_compile_definitions(wayland-server++ PRIVATE WAYLANDPP_IO_URING)
+endif()
 # Report undefined references only for the base library.
 if(${CMAKE_VERSION} VERSION_GREATER "3.14.0")
   target_link_options(wayland-server++ PRIVATE "-Wl,--no-undefined")
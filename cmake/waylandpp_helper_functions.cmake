@@ -14,6 +14,15 @@ endfunction()
 # generate client protocol source/headers from protocol XMLs
 function(generate_cpp_client_files PROTO_XMLS PROTO_FILES EXTRA_CMD_ARGS EXTRA_DEPENDS)
     list(APPEND COMMAND_LINE_ARGS ${PROTO_XMLS} ${PROTO_FILES} ${EXTRA_CMD_ARGS})
+    if(SPARSE_EVENT_HANDLERS)
+      list(APPEND COMMAND_LINE_ARGS "-e" "sparse")
+    endif()
+    if(LIGHTWEIGHT_EVENT_HANDLERS)
+      list(APPEND COMMAND_LINE_ARGS "-f" "handler")
+    endif()
+    if(VIEW_EVENT_HANDLERS)
+      list(APPEND COMMAND_LINE_ARGS "-v" "on")
+    endif()
     add_custom_command(
         OUTPUT ${PROTO_FILES}
         COMMAND "${WAYLAND_SCANNERPP}" ${COMMAND_LINE_ARGS}
@@ -42,6 +51,15 @@ endfunction()
 # generate server protocol source/headers from protocol XMLs
 function(generate_cpp_server_files PROTO_XMLS PROTO_FILES EXTRA_CMD_ARGS)
     list(APPEND COMMAND_LINE_ARGS ${PROTO_XMLS} ${PROTO_FILES} ${EXTRA_CMD_ARGS})
+    if(SPARSE_EVENT_HANDLERS)
+      list(APPEND COMMAND_LINE_ARGS "-e" "sparse")
+    endif()
+    if(LIGHTWEIGHT_EVENT_HANDLERS)
+      list(APPEND COMMAND_LINE_ARGS "-f" "handler")
+    endif()
+    if(VIEW_EVENT_HANDLERS)
+      list(APPEND COMMAND_LINE_ARGS "-v" "on")
+    endif()
     add_custom_command(
         OUTPUT ${PROTO_FILES}
         COMMAND "${WAYLAND_SCANNERPP}" "-s" "on" ${COMMAND_LINE_ARGS}
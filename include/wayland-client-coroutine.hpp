@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2026, Nils Christopher Brause, Philipp Kerling
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WAYLAND_CLIENT_COROUTINE_HPP
+#define WAYLAND_CLIENT_COROUTINE_HPP
+
+/*
+ * Awaitables for C++20 coroutines, which need complete protocol classes.
+ * This header is included at the end of wayland-client-protocol.hpp.
+ */
+
+#include <algorithm>
+#include <wayland-client.hpp>
+
+#ifdef WAYLANDPP_COROUTINES
+namespace wayland
+{
+  namespace detail
+  {
+    // Registry and globals shared by the lookups of a display
+    struct globals_state_t
+    {
+      registry_t registry;
+      callback_t sync;
+      std::vector<global_t> globals;
+      // the roundtrip after creating the registry is done
+      bool complete = false;
+      std::vector<std::coroutine_handle<>> waiters;
+    };
+  }
+
+  /** \brief Awaitable for the globals of a display, see display_t::globals_async()
+   */
+  class globals_awaitable_t
+  {
+  protected:
+    std::shared_ptr<detail::globals_state_t> state;
+
+  public:
+    explicit globals_awaitable_t(display_t &display)
+      : state(display.get_globals_state())
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+      return state->complete;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      state->waiters.push_back(handle);
+    }
+
+    std::vector<global_t> await_resume() const
+    {
+      return state->globals;
+    }
+  };
+
+  /** \brief Awaitable for a single global, see display_t::global_async()
+   */
+  class global_awaitable_t : private globals_awaitable_t
+  {
+  private:
+    std::string interface;
+
+  public:
+    global_awaitable_t(display_t &display, std::string interface)
+      : globals_awaitable_t(display), interface(std::move(interface))
+    {
+    }
+
+    using globals_awaitable_t::await_ready;
+    using globals_awaitable_t::await_suspend;
+
+    global_t await_resume() const
+    {
+      for(auto const &global : state->globals)
+        if(global.interface == interface)
+          return global;
+      return global_t();
+    }
+  };
+
+  inline std::shared_ptr<detail::globals_state_t> display_t::get_globals_state()
+  {
+    if(globals_state)
+      return globals_state;
+
+    // The handlers only capture the state itself, which owns the proxies.
+    auto state = std::make_shared<detail::globals_state_t>();
+    detail::globals_state_t *s = state.get();
+    state->registry = get_registry();
+    state->registry.on_global() = [s] (std::uint32_t name, const std::string &interface, std::uint32_t version)
+      {
+        s->globals.push_back(global_t{name, interface, version});
+      };
+    state->registry.on_global_remove() = [s] (std::uint32_t name)
+      {
+        s->globals.erase(std::remove_if(s->globals.begin(), s->globals.end(),
+                                        [name] (const global_t &global) { return global.name == name; }),
+                         s->globals.end());
+      };
+    state->sync = sync();
+    state->sync.on_done() = [s] (std::uint32_t)
+      {
+        // all globals have been announced
+        s->complete = true;
+        auto waiters = std::move(s->waiters);
+        s->sync = callback_t();
+        for(auto &waiter : waiters)
+          waiter.resume();
+      };
+    globals_state = state;
+    return state;
+  }
+
+  inline callback_awaitable_t<callback_t> display_t::sync_async()
+  {
+    return callback_awaitable_t<callback_t>(sync());
+  }
+
+  inline globals_awaitable_t display_t::globals_async()
+  {
+    return globals_awaitable_t(*this);
+  }
+
+  inline global_awaitable_t display_t::global_async(const std::string &interface)
+  {
+    return global_awaitable_t(*this, interface);
+  }
+}
+#endif
+
+#endif
@@ -28,12 +28,19 @@
 
 /** \file */
 
+#include <array>
 #include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
 #include <vector>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+/** \brief Defined if the awaitables for C++20 coroutines are available
+ */
+#define WAYLANDPP_COROUTINES
+#endif
 #include <wayland-version.hpp>
 #include <wayland-client-core.h>
 #include <wayland-util.hpp>
@@ -79,6 +86,7 @@ namespace wayland
   namespace detail
   {
     struct proxy_data_t;
+    struct globals_state_t;
     // base class for event listener storage.
     struct events_base_t
     {
@@ -158,14 +166,25 @@ namespace wayland
     // copy constructor filled in by the each interface class
     std::function<proxy_t(proxy_t)> copy_constructor;
 
-    // universal dispatcher
+    // universal dispatcher, fallback for the any based dispatchers
     static int c_dispatcher(const void *implementation, void *target,
                             uint32_t opcode, const wl_message *message,
                             wl_argument *args);
 
+    // dispatcher for the typed dispatchers generated by the scanner
+    static int c_typed_dispatcher(const void *implementation, void *target,
+                                  uint32_t opcode, const wl_message *message,
+                                  wl_argument *args);
+
+    void add_dispatcher(std::shared_ptr<detail::events_base_t> events,
+                        wl_dispatcher_func_t c_func, void *dispatcher);
+
+    // destroy the native object and the shared data after the last reference is gone
+    static void destroy(wl_proxy *proxy, detail::proxy_data_t *data, wrapper_type type);
+
     // marshal request
     proxy_t marshal_single(uint32_t opcode, const wl_interface *interface,
-                           const std::vector<detail::argument_t>& args, std::uint32_t version = 0);
+                           wl_argument *args, std::uint32_t version = 0);
 
   protected:
     void set_interface(const wl_interface *iface);
@@ -176,14 +195,17 @@ namespace wayland
     // Valid types for args are:
     // - uint32_t
     // - int32_t
-    // - proxy_t
+    // - double
+    // - wl_object* or nullptr
     // - std::string
     // - array_t
+    // - detail::argument_t::fd()
+    // The arguments are converted into a wl_argument array on the stack.
     template <typename...T>
     void marshal(uint32_t opcode, const T& ...args)
     {
-      std::vector<detail::argument_t> v = { detail::argument_t(args)... };
-      marshal_single(opcode, nullptr, v);
+      std::array<wl_argument, sizeof...(T)> v = {{ detail::wire_argument(args)... }};
+      marshal_single(opcode, nullptr, v.data());
     }
 
     // marshal a request that leads to a new proxy with inherited version
@@ -191,8 +213,8 @@ namespace wayland
     proxy_t marshal_constructor(uint32_t opcode, const wl_interface *interface,
                                 const T& ...args)
     {
-      std::vector<detail::argument_t> v = { detail::argument_t(args)... };
-      return marshal_single(opcode, interface, v);
+      std::array<wl_argument, sizeof...(T)> v = {{ detail::wire_argument(args)... }};
+      return marshal_single(opcode, interface, v.data());
     }
 
     // marshal a request that leads to a new proxy with specific version
@@ -200,8 +222,8 @@ namespace wayland
     proxy_t marshal_constructor_versioned(uint32_t opcode, const wl_interface *interface,
                                           uint32_t version, const T& ...args)
     {
-      std::vector<detail::argument_t> v = { detail::argument_t(args)... };
-      return marshal_single(opcode, interface, v, version);
+      std::array<wl_argument, sizeof...(T)> v = {{ detail::wire_argument(args)... }};
+      return marshal_single(opcode, interface, v.data(), version);
     }
 
     // Set the opcode for destruction of the proxy
@@ -215,9 +237,24 @@ namespace wayland
     void set_events(std::shared_ptr<detail::events_base_t> events,
                     int(*dispatcher)(uint32_t, const std::vector<detail::any>&, const std::shared_ptr<detail::events_base_t>&));
 
+    /*
+      Same as above, but the dispatcher reads the arguments directly
+      from the wl_argument array without boxing them. This is what the
+      scanner generates.
+    */
+    void set_events(std::shared_ptr<detail::events_base_t> events,
+                    int(*dispatcher)(uint32_t, const wl_argument*, const std::shared_ptr<detail::events_base_t>&));
+
+    // Argument conversion helpers for the typed dispatchers
+    static proxy_t new_id_argument(wl_object *o);
+    static array_t array_argument(wl_array *a);
+
     // Retrieve the previously set user data
     std::shared_ptr<detail::events_base_t> get_events();
 
+    // Whether the user data has already been set, without copying it
+    bool has_events() const;
+
     // Constructs NULL proxies.
     proxy_t() = default;
 
@@ -415,6 +452,83 @@ namespace wayland
   class callback_t;
   class registry_t;
 
+#ifdef WAYLANDPP_COROUTINES
+  /** \brief Awaitable for the done event of a wl_callback
+
+      Returned by display_t::sync_async() and by the *_async() variants
+      of requests creating a wl_callback, e.g. surface_t::frame_async().
+      co_await suspends the coroutine until the done event is dispatched
+      and yields the event data. The coroutine is resumed from the event
+      handler, i.e. from whichever thread dispatches the queue of the
+      callback, so that a single thread can wait for many callbacks
+      without blocking.
+
+      The handler is installed on construction, so the event is not lost
+      if it is dispatched before the awaitable is awaited.
+
+      \tparam C callback_t, which is not yet complete at this point
+  */
+  template <typename C>
+  class callback_awaitable_t
+  {
+  private:
+    struct state_t
+    {
+      std::uint32_t data = 0;
+      bool done = false;
+      std::coroutine_handle<> waiter;
+    };
+
+    C callback;
+    std::shared_ptr<state_t> state;
+
+  public:
+    explicit callback_awaitable_t(C cb)
+      : callback(std::move(cb)), state(detail::make_pooled<state_t>())
+    {
+      callback.on_done() = [state = state] (std::uint32_t data)
+        {
+          state->data = data;
+          state->done = true;
+          if(state->waiter)
+            std::exchange(state->waiter, nullptr).resume();
+        };
+    }
+
+    bool await_ready() const noexcept
+    {
+      return state->done;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) noexcept
+    {
+      state->waiter = handle;
+    }
+
+    std::uint32_t await_resume() const noexcept
+    {
+      return state->data;
+    }
+  };
+
+  /** \brief A global announced by the registry
+   */
+  struct global_t
+  {
+    std::uint32_t name = 0;   ///< Numeric name of the global, 0 if not found
+    std::string interface;    ///< Interface implemented by the global
+    std::uint32_t version = 0; ///< Maximum supported interface version
+
+    explicit operator bool() const noexcept
+    {
+      return name != 0;
+    }
+  };
+
+  class globals_awaitable_t;
+  class global_awaitable_t;
+#endif
+
   /** \brief Represents a connection to the compositor and acts as a
       proxy to the display singleton object.
 
@@ -481,7 +595,28 @@ namespace wayland
     // Construct as proxy wrapper
     display_t(proxy_t const &wrapped_proxy, construct_proxy_wrapper_tag /*unused*/);
 
+    // state of pump()
+    bool pump_prepared = false;
+    bool pump_flush_blocked = false;
+
+    // registry shared by globals_async() and global_async()
+    std::shared_ptr<detail::globals_state_t> globals_state;
+#ifdef WAYLANDPP_COROUTINES
+    std::shared_ptr<detail::globals_state_t> get_globals_state();
+    friend class globals_awaitable_t;
+#endif
+
   public:
+    /** \brief What to wait for before the next call of pump()
+
+        The display fd should always be watched for readability.
+     */
+    struct pump_result_t
+    {
+      bool want_write = false; ///< Also wait for it to become writable, since requests are still buffered
+      int dispatched = 0;      ///< Number of events dispatched by this call
+    };
+
     /** \brief Connect to Wayland display on an already open fd.
         \param fd The fd to use for the connection
 
@@ -537,7 +672,7 @@ namespace wayland
         This does not apply to display_t instances that are wrappers for
         a pre-established C wl_display.
     */
-    ~display_t() noexcept = default;
+    ~display_t() noexcept;
 
     /** \brief Create a new event queue for this display.
         \return A new event queue associated with this display or NULL
@@ -709,6 +844,39 @@ namespace wayland
     */
     int dispatch_pending() const;
 
+    /** \brief Non-blocking event pump for external event loops
+        \param readable whether the display fd was reported readable
+        \param writable whether the display fd was reported writable
+        \param queues additional event queues to dispatch
+        \return events to wait for before calling pump() again
+        \exception std::system_error on failure
+
+        Performs one step of the read protocol of libwayland, so that the
+        display can be driven by e.g. epoll with a single call per wakeup:
+        -# finalizes the read intent of the previous call, by reading if
+           the fd is readable and cancelling otherwise,
+        -# dispatches the main queue and the given queues,
+        -# announces the intent to read for the next wakeup, once the
+           main queue and the given queues are all empty,
+        -# flushes buffered requests, unless a previous flush could not
+           complete and the fd was not reported writable since.
+
+        The fd should then be watched for the returned events, e.g.
+        EPOLLIN and, if want_write is set, EPOLLOUT. Call pump(false, false)
+        once before waiting for the first time, and whenever requests
+        were sent outside of event handlers.
+
+        Since the intent to read is kept between calls, other threads
+        reading from the display wait until the next call of pump(). Call
+        pump_release() before using blocking functions like roundtrip()
+        or dispatch() outside of event handlers, or they wait forever.
+    */
+    pump_result_t pump(bool readable, bool writable, const std::vector<event_queue_t> &queues = {});
+
+    /** \brief Cancel the intent to read kept by pump()
+     */
+    void pump_release();
+
     /** \brief Retrieve the last error that occurred on a display.
         \return The last error that occurred on display or 0 if no error
         occurred
@@ -763,6 +931,121 @@ namespace wayland
     /** \brief create proxy wrapper for this display
      */
     display_t proxy_create_wrapper();
+
+#ifdef WAYLANDPP_COROUTINES
+    /** \brief asynchronous roundtrip for coroutines
+
+        Like sync(), but co_await on the returned object suspends the
+        coroutine until the server has processed all previous requests.
+    */
+    callback_awaitable_t<callback_t> sync_async();
+
+    /** \brief List the globals of the display in a coroutine
+
+        co_await on the returned object yields all globals. The names can
+        be bound with any registry of this display.
+
+        The globals are collected on a single registry of the display,
+        which is created by the first call. Calls made until the
+        roundtrip following its creation is done all wait for that
+        roundtrip, later calls yield the globals announced so far right
+        away.
+    */
+    globals_awaitable_t globals_async();
+
+    /** \brief Look up a global by interface name in a coroutine
+        \param interface interface name, e.g. "wl_compositor"
+
+        co_await on the returned object yields the first global
+        implementing the interface, or an empty global_t if there is none.
+        Uses the registry of globals_async(), so any number of lookups
+        costs a single registry and a single roundtrip.
+    */
+    global_awaitable_t global_async(const std::string &interface);
+#endif
+  };
+
+  /** \brief Dispatches event queues on a pool of worker threads
+
+      The dispatcher owns a reader thread and a number of worker
+      threads. Each event queue added to the dispatcher is assigned to
+      one worker, which dispatches it whenever new events were read. Queues
+      of different workers are dispatched in parallel, so a slow event
+      handler only delays the queues of its own worker.
+
+      The reader thread announces its intent to read with
+      wl_display_prepare_read, flushes the display, polls its file
+      descriptor and then reads or cancels, as required by libwayland.
+      Other threads may still read from the display in the same way, e.g.
+      with display_t::dispatch() for the main queue or
+      display_t::roundtrip_queue(). Events they read in the short time in
+      which the reader thread is not waiting are dispatched after its next
+      read.
+
+      Requests sent from the event handlers are flushed by the worker
+      after dispatching.
+
+      The queues of a dispatcher must not be dispatched by any other
+      thread. The display must outlive the dispatcher.
+
+      If reading or dispatching fails, all threads stop and the error is
+      rethrown by stop().
+  */
+  class queue_dispatcher_t
+  {
+  private:
+    struct data_t;
+    std::unique_ptr<data_t> data;
+
+  public:
+    /** \brief Start dispatching
+        \param display display to read from
+        \param threads number of worker threads, at least one
+    */
+    queue_dispatcher_t(display_t &display, unsigned int threads);
+
+    /** \brief Stop dispatching, see stop()
+
+        Errors of the threads are ignored.
+    */
+    ~queue_dispatcher_t() noexcept;
+
+    queue_dispatcher_t(const queue_dispatcher_t &) = delete;
+    queue_dispatcher_t &operator=(const queue_dispatcher_t &) = delete;
+
+    /** \brief Number of worker threads
+    */
+    unsigned int threads() const;
+
+    /** \brief Add a queue to the worker with the fewest queues
+        \param queue queue to dispatch
+        \return index of the worker dispatching the queue
+    */
+    unsigned int add_queue(const event_queue_t &queue);
+
+    /** \brief Add a queue to a specific worker
+        \param queue queue to dispatch
+        \param worker index of the worker, less than threads()
+    */
+    void add_queue(const event_queue_t &queue, unsigned int worker);
+
+    /** \brief Stop dispatching a queue
+
+        The worker notices the removal the next time it wakes up, so
+        events that are already queued may still be dispatched by it. The
+        queue is kept alive until then.
+    */
+    void remove_queue(const event_queue_t &queue);
+
+    /** \brief Stop all threads and wait for them
+
+        Queued events which were not dispatched yet remain in their
+        queues. Must not be called from an event handler of the
+        dispatcher.
+
+        \exception the first exception thrown by one of the threads
+    */
+    void stop();
   };
 }
 
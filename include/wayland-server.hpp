@@ -26,8 +26,10 @@
 #ifndef WAYLAND_SERVER_HPP
 #define WAYLAND_SERVER_HPP
 
+#include <array>
 #include <atomic>
 #include <cstdint>
+#include <exception>
 #include <functional>
 #include <list>
 #include <memory>
@@ -49,6 +51,9 @@ namespace wayland
         wl_listener listener = { { nullptr, nullptr }, nullptr };
         void *user = nullptr;
       };
+
+      struct backpressure_data_t;
+      struct coalesce_data_t;
     }
 
     /** \brief Type for functions that handle log messages
@@ -63,6 +68,9 @@ namespace wayland
      * error messages, by default to the standard output. This can be used
      * to set an alternate function that will receive those messages.
      *
+     * It also receives errors of the worker threads of a worker_pool_t, on
+     * those threads.
+     *
      * \param handler function that should be called for C library log messages
      */
     void set_log_handler(const log_handler& handler);
@@ -72,6 +80,7 @@ namespace wayland
     template <class resource> class global_t;
     class event_loop_t;
     class event_source_t;
+    template <class resource> class weak_resource_t;
 
     class display_t
     {
@@ -85,6 +94,9 @@ namespace wayland
         std::function<bool(client_t, global_base_t)> filter_func;
         wayland::detail::any user_data;
         std::atomic<unsigned int> counter{1};
+        // resources with coalesced events waiting to be sent
+        wl_list coalesced;
+        wl_event_source *coalesce_idle = nullptr;
       };
 
       wl_display *display = nullptr;
@@ -101,6 +113,7 @@ namespace wayland
       void fini();
 
       friend class client_t;
+      friend class resource_t;
       friend class global_base_t;
 
     public:
@@ -273,7 +286,7 @@ namespace wayland
     class client_t
     {
     private:
-      struct data_t
+      struct data_t : public wayland::detail::pooled_t
       {
         wl_client *client = nullptr;
         std::function<void()> destroy;
@@ -287,6 +300,9 @@ namespace wayland
 #endif
         std::function<void(resource_t&)> resource_created;
         detail::listener_t resource_created_listener;
+        // set while a backpressure_t considers the client congested
+        std::shared_ptr<detail::backpressure_data_t> backpressure;
+        bool drop_events = false;
       };
 
       wl_client *client = nullptr;
@@ -309,6 +325,7 @@ namespace wayland
 
       friend class display_t;
       friend class resource_t;
+      friend class backpressure_t;
       template <class resource> friend class global_t;
 
     public:
@@ -400,6 +417,21 @@ namespace wayland
        */
       int get_fd() const;
 
+      /** Get the number of bytes waiting in the client's socket
+       *
+       * \return The size of the socket send queue in bytes.
+       *
+       * These are events that were already flushed, but not yet read by the
+       * client. The kernel accounts some overhead per message, so the value is
+       * approximate. Once the socket is full, further events stay in the
+       * connection buffer of libwayland, which is not included.
+       */
+      std::size_t get_output_queue_size() const;
+
+      /** Whether a backpressure_t considers the client congested
+       */
+      bool is_congested() const;
+
       /** Add a callback to be called at the beginning of client destruction.
        *
        * The callback provided will be called when client destroy has begun,
@@ -496,6 +528,17 @@ namespace wayland
       std::function<void(resource_t&)> &on_resource_created();
     };
 
+    /** How coalesced events are merged
+     */
+    enum class coalesce_mode_t
+    {
+      /** The latest event replaces the previous ones */
+      latest,
+      /** Fixed-point arguments are summed up, e.g. for relative motion.
+       *  Other arguments are taken from the latest event. */
+      accumulate
+    };
+
     class resource_t
     {
     protected:
@@ -511,23 +554,44 @@ namespace wayland
       };
 
     private:
-      struct data_t
+      struct data_t : public wayland::detail::pooled_t
       {
         std::shared_ptr<events_base_t> events;
         std::function<void()> destroy;
         detail::listener_t destroy_listener;
         wayland::detail::any user_data;
         std::atomic<unsigned int> counter{1};
+        // shared with weak references, cleared on destruction
+        std::shared_ptr<bool> alive;
+        // outlives the resources of the client
+        client_t::data_t *client = nullptr;
+        // only known for resources created by this library
+        const wl_interface *interface = nullptr;
+        std::unique_ptr<detail::coalesce_data_t> coalesce;
       };
 
       wl_resource *resource = nullptr;
       data_t *data = nullptr;
 
       static void destroy_func(wl_listener *listener, void *data);
+      std::shared_ptr<bool> alive_token() const;
+      // whether the event is dropped because the client is congested
+      bool dropped(uint32_t opcode) const;
+      // whether the event has been taken by the coalescing queue
+      bool coalesced(uint32_t opcode, wl_argument *args, bool post) const;
+      detail::coalesce_data_t &coalesce_data();
+      uint32_t coalesce_opcode(const std::string &event_name);
+      static void coalesce_idle_func(void *data);
+      static void flush_coalesced(display_t::data_t *display, wl_client *client);
+      // universal dispatcher, fallback for the any based dispatchers
       static int c_dispatcher(const void *implementation, void *target,
                               uint32_t opcode, const wl_message *message,
                               wl_argument *args);
-      static int dummy_dispatcher(int opcode, const std::vector<wayland::detail::any>& args, const std::shared_ptr<resource_t::events_base_t>& events);
+      // dispatcher for the typed dispatchers generated by the scanner
+      static int c_typed_dispatcher(const void *implementation, void *target,
+                                    uint32_t opcode, const wl_message *message,
+                                    wl_argument *args);
+      static int dummy_dispatcher(uint32_t opcode, wl_resource *target, const wl_argument *args, const std::shared_ptr<resource_t::events_base_t>& events);
 
     protected:
       // Interface desctiption filled in by the each interface class
@@ -541,35 +605,69 @@ namespace wayland
       void set_events(const std::shared_ptr<events_base_t>& events,
                       int(*dispatcher)(int, const std::vector<wayland::detail::any>&, const std::shared_ptr<resource_t::events_base_t>&));
 
+      /*
+        Same as above, but the dispatcher reads the arguments directly
+        from the wl_argument array without boxing them. This is what the
+        scanner generates.
+      */
+      void set_events(const std::shared_ptr<events_base_t>& events,
+                      int(*dispatcher)(uint32_t, wl_resource*, const wl_argument*, const std::shared_ptr<resource_t::events_base_t>&));
+
+      // Argument conversion helpers for the typed dispatchers
+      static resource_t object_argument(wl_object *o);
+      static resource_t new_id_argument(wl_resource *parent, const wl_interface *interface, uint32_t id);
+      static wayland::array_t array_argument(wl_array *a);
+
       // Retrieve the perviously set user data
       std::shared_ptr<events_base_t> get_events() const;
 
+      // Whether the user data has already been set, without copying it
+      bool has_events() const;
+
       void post_event_array(uint32_t opcode, const std::vector<wayland::detail::argument_t>& v) const;
       void queue_event_array(uint32_t opcode, const std::vector<wayland::detail::argument_t>& v) const;
+      void post_event_array(uint32_t opcode, wl_argument *args) const;
+      void queue_event_array(uint32_t opcode, wl_argument *args) const;
 
+      // The arguments are converted into a wl_argument array on the stack
       template <typename...T>
-      void post_event(uint32_t opcode, T...args) const
+      void post_event(uint32_t opcode, const T&...args) const
       {
-        std::vector<wayland::detail::argument_t> v = { wayland::detail::argument_t(args)... };
-        if(c_ptr())
-          post_event_array(opcode, v);
+        std::array<wl_argument, sizeof...(T)> v = {{ wayland::detail::wire_argument(args)... }};
+        post_event_array(opcode, v.data());
       }
 
       template <typename...T>
-      void queue_event(uint32_t opcode, T...args) const
+      void queue_event(uint32_t opcode, const T&...args) const
       {
-        std::vector<wayland::detail::argument_t> v = { wayland::detail::argument_t(args)... };
-        if(c_ptr())
-          queue_event_array(opcode, v);
+        std::array<wl_argument, sizeof...(T)> v = {{ wayland::detail::wire_argument(args)... }};
+        queue_event_array(opcode, v.data());
       }
 
       template <typename...T>
-      void send_event(bool post, uint32_t opcode, T...args) const
+      void send_event(bool post, uint32_t opcode, const T&...args) const
       {
+        std::array<wl_argument, sizeof...(T)> v = {{ wayland::detail::wire_argument(args)... }};
         if(post)
-          post_event(opcode, args...);
+          post_event_array(opcode, v.data());
         else
-          queue_event(opcode, args...);
+          queue_event_array(opcode, v.data());
+      }
+
+      // Post or queue the same event to each resource in a range, converting the arguments only once.
+      // Resources with a version lower than since are skipped.
+      template <typename R, typename...T>
+      static void multicast_event(const R &resources, bool post, uint32_t opcode, uint32_t since, const T&...args)
+      {
+        std::array<wl_argument, sizeof...(T)> v = {{ wayland::detail::wire_argument(args)... }};
+        for(const resource_t &resource : resources)
+          if(resource && resource.get_version() >= since)
+          {
+            if(post)
+              resource.post_event_array(opcode, v.data());
+            else
+              resource.queue_event_array(opcode, v.data());
+          }
       }
 
       void post_error(uint32_t code, const std::string& msg) const;
@@ -577,7 +675,9 @@ namespace wayland
       resource_t(wl_resource *c);
       void init();
 
+      friend class display_t;
       friend class client_t;
+      template <class resource> friend class weak_resource_t;
 
     public:
       resource_t() = default;
@@ -641,6 +741,90 @@ namespace wayland
        */
       std::string get_class();
       std::function<void()> &on_destroy();
+
+      /** Coalesce an event until the clients are flushed
+       *
+       * \param event_name Name of the event as in the protocol, e.g.
+       *                   "motion".
+       * \param mode How consecutive events are merged.
+       *
+       * Instead of being sent right away, the event is held back and merged
+       * with the following ones of the same kind, so that only one of them
+       * is sent per flush. This is meant for high-frequency events like
+       * pointer motion, which the client is only interested in the latest
+       * state of.
+       *
+       * The held back events are sent at the end of the current event loop
+       * dispatch, by display_t::flush_clients() and client_t::flush(), or
+       * right before any other event of this resource, so the order of the
+       * events of the resource is kept except within a group of coalesced
+       * events. Only events with integer and fixed arguments can be
+       * coalesced, and only for resources created by this library.
+       */
+      void coalesce_event(const std::string &event_name, coalesce_mode_t mode = coalesce_mode_t::latest);
+
+      /** Set the event that ends a group of coalesced events
+       *
+       * \param event_name Name of the event as in the protocol, e.g.
+       *                   "frame".
+       *
+       * If sent while coalesced events are held back, the event is held back
+       * as well, and only sent once after them. Consecutive groups are thus
+       * merged into one, instead of each sending its own frame event.
+       */
+      void set_coalesce_frame(const std::string &event_name);
+    };
+
+    /** Weak reference to a resource
+     *
+     * \tparam resource Resource class returned by lock()
+     *
+     * Copies of a resource_t must not be used after the resource has been
+     * destroyed. A weak reference on the other hand notices the destruction
+     * and may thus be kept around for work that finishes later, e.g. on a
+     * worker_pool_t. It can be copied and destroyed on any thread, but
+     * lock() and expired() must only be called on the thread dispatching
+     * the event loop of the display.
+     */
+    template <class resource>
+    class weak_resource_t
+    {
+    private:
+      wl_resource *ptr = nullptr;
+      std::shared_ptr<bool> alive;
+
+    public:
+      weak_resource_t() = default;
+
+      weak_resource_t(const resource &r)
+      {
+        if(r)
+        {
+          ptr = r.c_ptr();
+          alive = r.alive_token();
+        }
+      }
+
+      /** Check whether the resource has been destroyed
+       *
+       * \return true if the resource has been destroyed or this reference is
+       *         empty.
+       */
+      bool expired() const
+      {
+        return !alive || !*alive;
+      }
+
+      /** Get the resource
+       *
+       * \return The resource, or an empty resource if it has been destroyed.
+       */
+      resource lock() const
+      {
+        if(expired())
+          return resource();
+        return resource(resource_t(ptr));
+      }
     };
 
     /** Global object base class */
@@ -783,14 +967,16 @@ namespace wayland
     class event_loop_t
     {
     private:
+      // Dispatch function of an event source, freed together with the source
+      struct source_data_t;
+      template <typename F> struct source_func_t;
+
       struct data_t
       {
         std::function<void()> destroy;
         detail::listener_t destroy_listener;
-        std::list<std::function<int(int, uint32_t)>> fd_funcs;
-        std::list<std::function<int()>> timer_funcs;
-        std::list<std::function<int(int)>> signal_funcs;
-        std::list<std::function<void()>> idle_funcs;
+        // list of source_data_t, which are detached when the loop is destroyed
+        wl_list sources;
         wayland::detail::any user_data;
         bool do_delete = true;
         std::atomic<unsigned int> counter{1};
@@ -801,6 +987,8 @@ namespace wayland
 
       static data_t *wl_event_loop_get_user_data(wl_event_loop *client);
       static void destroy_func(wl_listener *listener, void *data);
+      static void release_source(source_data_t *source);
+      event_source_t make_source(source_data_t *source, wl_event_source *p);
       static int event_loop_fd_func(int fd, uint32_t mask, void *data);
       static int event_loop_timer_func(void *data);
       static int event_loop_signal_func(int signal_number, void *data);
@@ -882,8 +1070,7 @@ namespace wayland
        * callback function has been called.
        *
        * An idle task can be cancelled before the callback has been called by
-       * event_source_t::remove(). Calling event_source_t::remove() after or from
-       * within the callback results in undefined behaviour.
+       * destroying all copies of the returned event source.
        */
       event_source_t add_idle(const std::function<void()> &func);
       const std::function<void()> &on_destroy();
@@ -927,18 +1114,19 @@ namespace wayland
       int get_fd() const;
     };
 
+    /** Event source of an event loop
+     *
+     * The source is removed from the event loop, and its dispatch function
+     * freed, once the last copy of the event_source_t is destroyed.
+     */
     class event_source_t : public wayland::detail::refcounted_wrapper<wl_event_source>
     {
-    private:
-      wl_event_source *event_source = nullptr;
-
     protected:
-      event_source_t(wl_event_source *p);
+      event_source_t(std::shared_ptr<wl_event_source> p);
       friend class event_loop_t;
 
     public:
       event_source_t() = delete;
-      wl_event_source *c_ptr() const;
 
       /** Arm or disarm a timer
        *
@@ -986,6 +1174,336 @@ namespace wayland
        */
       void check() const;
     };
+
+    /** Thread pool for work that should not block the event loop
+     *
+     * Work posted to the pool runs on one of its threads. Its completion
+     * function is afterwards called from event_loop_t::dispatch() on the
+     * thread dispatching the event loop, which is woken up through an eventfd.
+     * Completion functions are called in the order in which the work
+     * finished, and may use resources and send events as usual. Resources
+     * needed by the completion function should be captured as
+     * weak_resource_t, since the client may destroy them in the meantime.
+     *
+     * The work itself must not use any of the library objects. The event loop
+     * must outlive the pool.
+     */
+    class worker_pool_t
+    {
+    private:
+      struct data_t;
+      std::unique_ptr<data_t> data;
+
+    public:
+      /** Start the worker threads
+       *
+       * \param event_loop The event loop that calls the completion functions.
+       * \param threads Number of worker threads, at least one.
+       */
+      worker_pool_t(const event_loop_t &event_loop, unsigned int threads);
+
+      /** Stop the worker threads
+       *
+       * Work that is currently running is waited for. Work that did not start
+       * yet, and completion functions that were not called yet, are dropped.
+       * Must not be called from a completion function.
+       */
+      ~worker_pool_t() noexcept;
+
+      worker_pool_t(const worker_pool_t &) = delete;
+      worker_pool_t &operator=(const worker_pool_t &) = delete;
+
+      /** Number of worker threads
+       */
+      unsigned int threads() const;
+
+      /** Run work on one of the worker threads
+       *
+       * \param work The function executed by the worker thread.
+       * \param done The completion function, called from the event loop after
+       *             work returned. May be empty.
+       *
+       * May be called from any thread.
+       */
+      void post(const std::function<void()> &work, const std::function<void()> &done = {});
+
+      /** Handler for exceptions thrown by the work
+       *
+       * The handler is called from the event loop instead of the completion
+       * function. If no handler is set, the exception is rethrown from
+       * event_loop_t::dispatch(), as are exceptions thrown by completion
+       * functions. Remaining completion functions are called during the next
+       * dispatch.
+       */
+      std::function<void(std::exception_ptr)> &on_error();
+    };
+
+    class timer_wheel_t;
+
+    /** Timer of a timer_wheel_t
+     *
+     * The timer is stopped and freed once the last copy is destroyed.
+     */
+    class wheel_timer_t
+    {
+    private:
+      struct data_t;
+      std::shared_ptr<data_t> data;
+
+      wheel_timer_t(std::shared_ptr<data_t> d);
+      friend class timer_wheel_t;
+
+    public:
+      /** Create an empty timer
+       */
+      wheel_timer_t() = default;
+
+      /** Start or restart the timer
+       *
+       * \param ms_delay The timeout in milliseconds.
+       *
+       * The dispatch function is called once from event_loop_t::dispatch()
+       * after the timeout expired. If the timer was already running, the
+       * previous timeout is replaced.
+       */
+      void start(unsigned int ms_delay) const;
+
+      /** Stop the timer without calling the dispatch function
+       */
+      void stop() const;
+
+      /** Check whether the timer is running
+       */
+      bool pending() const;
+
+      operator bool() const;
+    };
+
+    /** Many timers on a single timer event source
+     *
+     * Every event_loop_t::add_timer() source is a kernel timer of its own,
+     * and re-arming it is a system call. A timer wheel instead keeps its
+     * timers in four levels of 64 slots each, with a resolution of one
+     * millisecond in the first level. Starting and stopping a timer takes
+     * constant time, and the single event source of the wheel is only re-armed
+     * when the earliest expiry moves forward. Timers further away than the
+     * range of the wheel (about four and a half hours) are moved down the
+     * levels again until they expire.
+     *
+     * The wheel and its timers must only be used from the thread dispatching
+     * the event loop, which must outlive the wheel. The wheel must not be
+     * destroyed from a dispatch function. Timers outliving the wheel can no
+     * longer be started.
+     */
+    class timer_wheel_t
+    {
+    private:
+      struct data_t;
+      std::unique_ptr<data_t> data;
+
+      friend class wheel_timer_t;
+
+    public:
+      /** Create a timer wheel
+       *
+       * \param event_loop The event loop that calls the dispatch functions.
+       */
+      timer_wheel_t(event_loop_t &event_loop);
+      ~timer_wheel_t() noexcept;
+
+      timer_wheel_t(const timer_wheel_t &) = delete;
+      timer_wheel_t &operator=(const timer_wheel_t &) = delete;
+
+      /** Create a timer
+       *
+       * \param func The timer dispatch function.
+       * \return A new timer, which is initially stopped.
+       */
+      wheel_timer_t add_timer(const std::function<void()> &func);
+
+      /** Number of running timers
+       */
+      std::size_t pending() const;
+    };
+
+    class io_uring_backend_t;
+
+    /** File descriptor source of an io_uring_backend_t
+     *
+     * The source is removed once the last copy is destroyed.
+     */
+    class io_uring_source_t
+    {
+    private:
+      struct data_t;
+      std::shared_ptr<data_t> data;
+
+      io_uring_source_t(std::shared_ptr<data_t> d);
+      friend class io_uring_backend_t;
+
+    public:
+      /** Create an empty source
+       */
+      io_uring_source_t() = default;
+
+      /** Update the event mask
+       *
+       * \param mask The new mask.
+       *
+       * Like event_source_t::fd_update(), but the change is submitted
+       * together with other pending changes before the event loop goes to
+       * sleep.
+       */
+      void fd_update(const fd_event_mask_t& mask) const;
+
+      operator bool() const;
+    };
+
+    /** Polls file descriptor sources through io_uring
+     *
+     * File descriptors added to the backend are watched with multishot
+     * polls on an io_uring instead of the epoll set of the event loop. Adding
+     * a source or changing its mask does not cost a system call of its own,
+     * the changes are submitted in one batch before the event loop goes to
+     * sleep, or after the completions have been dispatched. The ring itself is
+     * a single file descriptor source of the event loop, so readiness of many
+     * sources is reaped with one wakeup and without further system calls.
+     *
+     * Requires Linux 5.13 and a library built with IO_URING_BACKEND. The
+     * sockets of the clients are still read and written by libwayland.
+     *
+     * The backend and its sources must only be used from the thread
+     * dispatching the event loop, which must outlive the backend. The backend
+     * must not be destroyed from a dispatch function.
+     */
+    class io_uring_backend_t
+    {
+    private:
+      struct data_t;
+      std::unique_ptr<data_t> data;
+
+      friend class io_uring_source_t;
+
+    public:
+      /** Check whether io_uring is supported by the library and the kernel
+       */
+      static bool available();
+
+      /** Create an io_uring instance and add it to the event loop
+       *
+       * \param event_loop The event loop that calls the dispatch functions.
+       * \param entries Size of the submission queue.
+       *
+       * Throws std::runtime_error if io_uring is not available.
+       */
+      io_uring_backend_t(event_loop_t &event_loop, unsigned int entries = 256);
+      ~io_uring_backend_t() noexcept;
+
+      io_uring_backend_t(const io_uring_backend_t &) = delete;
+      io_uring_backend_t &operator=(const io_uring_backend_t &) = delete;
+
+      /** Create a file descriptor source
+       *
+       * \param fd The file descriptor to watch.
+       * \param mask A bitwise-or of which events to watch for.
+       * \param func The file descriptor dispatch function.
+       * \return A new file descriptor source.
+       *
+       * Same as event_loop_t::add_fd(). The return value of func is ignored.
+       */
+      io_uring_source_t add_fd(int fd, const fd_event_mask_t& mask, const std::function<int(int, uint32_t)> &func);
+    };
+
+    /** What to do with a client that crossed the high-water mark
+     */
+    enum class backpressure_action_t
+    {
+      /** Only mark the client as congested */
+      keep,
+      /** Mark the client as congested and drop its droppable events */
+      drop,
+      /** Disconnect the client */
+      disconnect
+    };
+
+    /** Watch the socket occupancy of the clients of a display
+     *
+     * A client that stops reading its socket makes the compositor buffer its
+     * events, up to the maximum buffer size, after which libwayland
+     * disconnects it. This class reports clients whose socket send queue, as
+     * returned by client_t::get_output_queue_size(), grows beyond a high-water
+     * mark, so the compositor can react earlier: drop events that are not
+     * worth queueing (like pointer motion), hold back frame callbacks while
+     * client_t::is_congested() is true, or disconnect the client.
+     *
+     * The queue size is measured in the kernel, so it cannot grow beyond the
+     * send buffer size of the socket (SO_SNDBUF, a few hundred KiB by default
+     * on Linux), and a high-water mark above it is never reached. Events
+     * libwayland buffers after the socket is full are not included; to bound
+     * them, use client_t::set_max_buffer_size() in addition.
+     *
+     * The clients are checked by check(), which should be called after the
+     * clients have been flushed, or from a timer source. Only one instance
+     * should be used per display, and the display must outlive it. The
+     * handlers must not destroy clients themselves.
+     */
+    class backpressure_t
+    {
+    private:
+      std::shared_ptr<detail::backpressure_data_t> data;
+
+    public:
+      /** Create a monitor for the clients of a display
+       *
+       * \param display The display whose clients are checked.
+       * \param high_water Queue size in bytes at which a client becomes
+       *                   congested.
+       * \param low_water Queue size in bytes at which a congested client
+       *                  recovers. Must not be larger than high_water.
+       */
+      backpressure_t(display_t &display, std::size_t high_water, std::size_t low_water);
+
+      /** Clears the congestion of all clients
+       */
+      ~backpressure_t() noexcept;
+
+      backpressure_t(const backpressure_t &) = delete;
+      backpressure_t &operator=(const backpressure_t &) = delete;
+
+      /** Mark an event as droppable
+       *
+       * \param interface_name Name of the interface, e.g.
+       *                       pointer_t::interface_name.
+       * \param event_name Name of the event as in the protocol, e.g.
+       *                   "motion".
+       *
+       * Droppable events are silently discarded for congested clients for
+       * which the high-water handler returned backpressure_action_t::drop.
+       */
+      void add_droppable_event(const std::string &interface_name, const std::string &event_name);
+
+      /** Check the queue sizes of all clients
+       *
+       * Calls the handlers for clients that crossed one of the marks since
+       * the last check. Clients to be disconnected are destroyed after all
+       * clients have been checked.
+       */
+      void check();
+
+      /** Handler for clients that crossed the high-water mark
+       *
+       * Called with the client and its queue size. Without a handler, the
+       * action is backpressure_action_t::keep.
+       */
+      std::function<backpressure_action_t(client_t&, std::size_t)> &on_high_water();
+
+      /** Handler for congested clients that dropped below the low-water mark
+       *
+       * Called with the client and its queue size, after the client has been
+       * unmarked. A good place to send frame callbacks held back.
+       */
+      std::function<void(client_t&, std::size_t)> &on_low_water();
+    };
   }
 }
 
@@ -27,9 +27,20 @@
 #define WAYLAND_UTIL_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#include <type_traits>
 #include <typeinfo>
 #include <utility>
 #include <vector>
@@ -47,11 +58,52 @@ namespace wayland
 
   class array_t;
 
+  template <typename T = std::uint8_t>
+  class array_view_t;
+
   namespace server
   {
     class resource_t;
   }
 
+  /** \brief Allocation functions for the per-object bookkeeping
+   *
+   * Proxies, resources and clients keep their shared state and event
+   * handler tables on the heap. By default these blocks are recycled in a
+   * small pool per thread, so that objects which are created and destroyed
+   * every frame do not reach the general purpose allocator. Blocks may be
+   * freed on a different thread than the one they were allocated on.
+   */
+  struct object_allocator_t
+  {
+    /** \brief Allocate size bytes, suitably aligned for any fundamental type
+     *
+     * Must throw std::bad_alloc on failure.
+     */
+    void *(*allocate)(std::size_t size);
+
+    /** \brief Free a block returned by allocate with the same size
+     *
+     * Must not throw.
+     */
+    void (*deallocate)(void *ptr, std::size_t size);
+  };
+
+  /** \brief Replace the allocator used for the per-object bookkeeping
+   *
+   * This must be called before any proxy, resource or client object is
+   * created, since blocks are always returned to the allocator they came
+   * from. The allocator is not synchronized by the library; it has to be
+   * safe to call from every thread that creates or destroys objects.
+   *
+   * \param allocator new allocator
+   */
+  void set_object_allocator(const object_allocator_t &allocator);
+
+  /** \brief Get the default, pooling object allocator
+   */
+  object_allocator_t default_object_allocator();
+
   namespace detail
   {
     /** \brief Check the return value of a C function and throw exception on
@@ -64,6 +116,215 @@ namespace wayland
      */
     int check_return_value(int return_value, std::string const &function_name);
 
+    /** \brief Decoded signature of a wl_message
+     *
+     * The signature string of a message is parsed only once into this
+     * structure, so that dispatchers can walk the arguments by index.
+     * Untyped new_id arguments are listed with their three wire arguments
+     * (interface name, version and id), just like in the signature.
+     */
+    struct message_signature_t
+    {
+      /** \brief Description of a single wire argument
+       */
+      struct argument_info_t
+      {
+        char type;     ///< Argument type: i, u, f, s, o, n, a or h
+        bool nullable; ///< Whether the argument may be null
+      };
+
+      std::uint32_t since = 1;                 ///< Version the message was introduced in
+      std::vector<argument_info_t> arguments;  ///< Wire arguments in order
+      bool has_new_id = false;                 ///< Whether the message creates a new object
+
+      /** \brief Number of wire arguments
+       */
+      std::size_t arity() const
+      {
+        return arguments.size();
+      }
+    };
+
+    /** \brief Get the decoded signature of a message
+     *
+     * \param message message whose signature should be decoded
+     * \return decoded signature, cached per message in a table shared by all threads
+     */
+    const message_signature_t &message_signature(const wl_message *message);
+
+    /** \brief Reference counter for data shared by copies of a wrapper
+     *
+     * Taking another reference needs no ordering, since the caller already
+     * holds one. Dropping a reference uses acquire-release ordering, so that
+     * whoever drops the last one sees all writes made through the others.
+     *
+     * If the library is built with WAYLANDPP_REFCOUNT_STATISTICS defined,
+     * the atomic read-modify-write operations are counted per thread.
+     */
+    class refcount_t
+    {
+    private:
+      std::atomic<unsigned int> count{1};
+
+    public:
+      /** \brief Number of counted operations on the calling thread
+       */
+      static std::size_t &operations() noexcept;
+
+      void acquire() noexcept
+      {
+#ifdef WAYLANDPP_REFCOUNT_STATISTICS
+        operations()++;
+#endif
+        count.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      /** \brief Drop a reference
+       *
+       * \return true if this was the last reference
+       */
+      bool release() noexcept
+      {
+#ifdef WAYLANDPP_REFCOUNT_STATISTICS
+        operations()++;
+#endif
+        return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+      }
+    };
+
+    /** \brief Allocate a bookkeeping block through the object allocator
+     */
+    void *allocate_object(std::size_t size);
+
+    /** \brief Free a block returned by allocate_object
+     */
+    void deallocate_object(void *ptr, std::size_t size) noexcept;
+
+    /** \brief Base class for structures allocated with the object allocator
+     */
+    struct pooled_t
+    {
+      static void *operator new(std::size_t size)
+      {
+        return allocate_object(size);
+      }
+
+      static void operator delete(void *ptr, std::size_t size) noexcept
+      {
+        deallocate_object(ptr, size);
+      }
+    };
+
+    /** \brief Standard allocator adaptor for the object allocator
+     */
+    template <typename T>
+    struct pool_allocator_t
+    {
+      using value_type = T;
+
+      pool_allocator_t() = default;
+
+      template <typename U>
+      pool_allocator_t(const pool_allocator_t<U> & /*unused*/) noexcept
+      {
+      }
+
+      T *allocate(std::size_t n)
+      {
+        return static_cast<T*>(allocate_object(n * sizeof(T)));
+      }
+
+      void deallocate(T *ptr, std::size_t n) noexcept
+      {
+        deallocate_object(ptr, n * sizeof(T));
+      }
+
+      template <typename U>
+      bool operator==(const pool_allocator_t<U> & /*unused*/) const noexcept
+      {
+        return true;
+      }
+
+      template <typename U>
+      bool operator!=(const pool_allocator_t<U> & /*unused*/) const noexcept
+      {
+        return false;
+      }
+    };
+
+    /** \brief Create a shared object and its control block in one pooled block
+     */
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make_pooled(Args&&... args)
+    {
+      return std::allocate_shared<T>(pool_allocator_t<T>(), std::forward<Args>(args)...);
+    }
+
+    /** \brief Sparse storage for the event handlers of an object
+     *
+     * Used by the generated events_t structs if the scanner is run with
+     * "-e sparse", instead of one std::function member per event. Until a
+     * handler is accessed, only a null pointer is stored. Then a table of
+     * N pointers is allocated, and every handler gets its own block, so
+     * only accessed handlers take up space. Lookup is by index.
+     *
+     * \tparam N number of handlers
+     */
+    template <std::size_t N>
+    class handler_table_t
+    {
+    private:
+      struct slot_t : public pooled_t
+      {
+        virtual ~slot_t() = default;
+      };
+
+      template <typename F>
+      struct handler_t : public slot_t
+      {
+        F func;
+      };
+
+      struct table_t : public pooled_t
+      {
+        std::array<std::unique_ptr<slot_t>, N> slots;
+      };
+
+      std::unique_ptr<table_t> table;
+
+    public:
+      /** \brief Get a handler, creating it if necessary
+       *
+       * \tparam F type of the handler, must be the same for every call with the same index
+       * \param index index of the handler
+       */
+      template <typename F>
+      F &get(std::size_t index)
+      {
+        if(!table)
+          table.reset(new table_t);
+        auto &slot = table->slots.at(index);
+        if(!slot)
+          slot.reset(new handler_t<F>);
+        return static_cast<handler_t<F>&>(*slot).func;
+      }
+
+      /** \brief Find a handler which is set
+       *
+       * \tparam F type of the handler, see get()
+       * \param index index of the handler
+       * \return the handler, or nullptr if it was never accessed or is empty
+       */
+      template <typename F>
+      const F *find(std::size_t index) const
+      {
+        if(!table || !table->slots[index])
+          return nullptr;
+        const F &func = static_cast<const handler_t<F>&>(*table->slots[index]).func;
+        return func ? &func : nullptr;
+      }
+    };
+
     /** \brief Non-refcounted wrapper for C objects
      *
      * This is by default copyable. If this is not desired, delete the
@@ -227,9 +488,50 @@ namespace wayland
       }
     };
 
+    /** \brief Type erased value container
+     *
+     * Trivially copyable values up to the size of two pointers are stored
+     * inside the object itself, so that boxing integers, doubles or plain
+     * handles never allocates. Larger values are stored on the heap.
+     * Types are compared by the address of a per-type tag first and only
+     * fall back to comparing std::type_info when the addresses differ.
+     */
     class any
     {
     private:
+      // unique address per type within one module
+      struct tag_t
+      {
+        const std::type_info &info;
+      };
+
+      template <typename T>
+      struct type_tag
+      {
+        static const tag_t id;
+      };
+
+      template <typename T>
+      static const tag_t *tag_of()
+      {
+        return &type_tag<T>::id;
+      }
+
+      // Shared libraries with hidden visibility or loaded with RTLD_LOCAL
+      // may have their own tag for the same type, so the address
+      // comparison falls back to comparing the type_info.
+      template <typename T>
+      bool has_type() const
+      {
+        return tag == tag_of<T>() || (tag && tag->info == typeid(T));
+      }
+
+      template <typename T>
+      struct stored_inline
+        : std::integral_constant<bool, std::is_trivially_copyable<T>::value
+                                 && sizeof(T) <= 2 * sizeof(void*)
+                                 && alignof(T) <= alignof(std::max_align_t)> {};
+
       class base
       {
       public:
@@ -239,7 +541,6 @@ namespace wayland
         base& operator=(const base&) = default;
         base& operator=(base&&) noexcept = default;
         virtual ~base() noexcept = default;
-        virtual const std::type_info &type_info() const = 0;
         virtual base *clone() const = 0;
       };
 
@@ -254,24 +555,84 @@ namespace wayland
         derived(T t)
           : val(std::move(t)) { }
 
-        const std::type_info &type_info() const override
-        {
-          return typeid(T);
-        }
-
         base *clone() const override
         {
           return new derived<T>(val);
         }
       };
 
+      union storage_t
+      {
+        void *ptr[2];
+        double d;
+        long long ll;
+        long double ld;
+      };
+
+      const tag_t *tag = nullptr;
       base *val = nullptr;
+      storage_t storage;
+
+      template <typename T>
+      T *inline_ptr()
+      {
+        return reinterpret_cast<T*>(&storage);
+      }
+
+      template <typename T>
+      const T *inline_ptr() const
+      {
+        return reinterpret_cast<const T*>(&storage);
+      }
+
+      template <typename T>
+      void construct(const T &t, std::true_type /*inline*/)
+      {
+        new (&storage) T(t);
+      }
+
+      template <typename T>
+      void construct(const T &t, std::false_type /*inline*/)
+      {
+        val = new derived<T>(t);
+      }
+
+      template <typename T>
+      T &value(std::true_type /*inline*/)
+      {
+        return *inline_ptr<T>();
+      }
+
+      template <typename T>
+      T &value(std::false_type /*inline*/)
+      {
+        return static_cast<derived<T>*>(val)->val;
+      }
+
+      template <typename T>
+      const T &value(std::true_type /*inline*/) const
+      {
+        return *inline_ptr<T>();
+      }
+
+      template <typename T>
+      const T &value(std::false_type /*inline*/) const
+      {
+        return static_cast<derived<T>*>(val)->val;
+      }
+
+      void reset() noexcept
+      {
+        delete val;
+        val = nullptr;
+        tag = nullptr;
+      }
 
     public:
       any() = default;
 
       any(const any &a)
-        : val(a.val ? a.val->clone() : nullptr) { }
+        : tag(a.tag), val(a.val ? a.val->clone() : nullptr), storage(a.storage) { }
 
       any(any &&a) noexcept
       {
@@ -280,7 +641,10 @@ namespace wayland
 
       template <typename T>
       any(const T &t)
-        : val(new derived<T>(t)) { }
+        : tag(tag_of<T>())
+      {
+        construct(t, stored_inline<T>());
+      }
 
       ~any() noexcept
       {
@@ -291,48 +655,65 @@ namespace wayland
       {
         if(&a != this)
         {
+          base *tmp = a.val ? a.val->clone() : nullptr;
           delete val;
-          val = a.val ? a.val->clone() : nullptr;
+          val = tmp;
+          tag = a.tag;
+          storage = a.storage;
         }
         return *this;
       }
 
       any &operator=(any &&a) noexcept
       {
+        std::swap(tag, a.tag);
         std::swap(val, a.val);
+        std::swap(storage, a.storage);
         return *this;
       }
 
       template <typename T>
       any &operator=(const T &t)
       {
-        if(val && typeid(T) == val->type_info())
-          static_cast<derived<T>*>(val)->val = t;
+        if(has_type<T>())
+          value<T>(stored_inline<T>()) = t;
         else
         {
-          delete val;
-          val = new derived<T>(t);
+          reset();
+          construct(t, stored_inline<T>());
+          tag = tag_of<T>();
         }
         return *this;
       }
 
+      /** \brief Check whether a value of type T is stored
+       */
+      template <typename T>
+      bool holds() const
+      {
+        return has_type<T>();
+      }
+
       template <typename T>
       T &get()
       {
-        if(val && typeid(T) == val->type_info())
-          return static_cast<derived<T>*>(val)->val;
+        if(has_type<T>())
+          return value<T>(stored_inline<T>());
         throw std::bad_cast();
       }
 
       template <typename T>
       const T &get() const
       {
-        if(val && typeid(T) == val->type_info())
-          return static_cast<derived<T>*>(val)->val;
+        if(has_type<T>())
+          return value<T>(stored_inline<T>());
         throw std::bad_cast();
       }
     };
 
+    template <typename T>
+    const any::tag_t any::type_tag<T>::id = { typeid(T) };
+
     template<unsigned int size, int id = 0>
     class bitfield
     {
@@ -466,8 +847,296 @@ namespace wayland
        */
       wl_argument get_c_argument() const;
     };
+
+    /** \brief Convert a request argument into its wire representation
+     *
+     * Unlike argument_t, this never copies: strings and arrays are
+     * referenced, so the result must not outlive the passed value. Used
+     * to marshal requests from a stack allocated wl_argument array.
+     */
+    inline wl_argument wire_argument(uint32_t u)
+    {
+      wl_argument a;
+      a.u = u;
+      return a;
+    }
+
+    inline wl_argument wire_argument(int32_t i)
+    {
+      wl_argument a;
+      a.i = i;
+      return a;
+    }
+
+    inline wl_argument wire_argument(double f)
+    {
+      wl_argument a;
+      a.f = wl_fixed_from_double(f);
+      return a;
+    }
+
+    inline wl_argument wire_argument(const std::string &s)
+    {
+      wl_argument a;
+      a.s = s.c_str();
+      return a;
+    }
+
+    inline wl_argument wire_argument(wl_object *o)
+    {
+      wl_argument a;
+      a.o = o;
+      return a;
+    }
+
+    inline wl_argument wire_argument(std::nullptr_t)
+    {
+      wl_argument a;
+      a.n = 0;
+      return a;
+    }
+
+    inline wl_argument wire_argument(const argument_t &arg)
+    {
+      return arg.get_c_argument();
+    }
+
+    wl_argument wire_argument(const array_t &arr);
+
+    template <typename T>
+    wl_argument wire_argument(const array_view_t<T> &arr)
+    {
+      wl_argument a;
+      a.a = const_cast<wl_array*>(arr.c_ptr());
+      return a;
+    }
   }
 
+  /** \brief Non-owning reference to a string argument
+   *
+   * Event handlers taking string_view_t instead of std::string receive
+   * the string inside libwayland's connection buffer without copying it.
+   * The view is only valid for the duration of the handler; convert it to
+   * std::string to keep it. A null string argument can be told apart from
+   * an empty one with is_null(). These handlers are only generated if the
+   * scanner is run with -v on.
+   */
+  class string_view_t
+  {
+  private:
+    const char *ptr = nullptr;
+    std::size_t len = 0;
+
+  public:
+    string_view_t() = default;
+
+    string_view_t(const char *str)
+      : ptr(str), len(str ? std::strlen(str) : 0)
+    {
+    }
+
+    string_view_t(const std::string &str)
+      : ptr(str.c_str()), len(str.size())
+    {
+    }
+
+    /** \brief Pointer to the null terminated string, never a null pointer
+     */
+    const char *data() const
+    {
+      return ptr ? ptr : "";
+    }
+
+    std::size_t size() const
+    {
+      return len;
+    }
+
+    bool empty() const
+    {
+      return len == 0;
+    }
+
+    /** \brief Whether the argument was a null string
+     */
+    bool is_null() const
+    {
+      return !ptr;
+    }
+
+    std::string str() const
+    {
+      return std::string(data(), len);
+    }
+
+    operator std::string() const
+    {
+      return str();
+    }
+
+#if __cplusplus >= 201703L
+    operator std::string_view() const
+    {
+      return std::string_view(data(), len);
+    }
+#endif
+
+    bool operator==(const string_view_t &right) const
+    {
+      return len == right.len && std::memcmp(data(), right.data(), len) == 0;
+    }
+
+    bool operator!=(const string_view_t &right) const
+    {
+      return !(*this == right);
+    }
+  };
+
+  /** \brief Non-owning typed view of an array argument
+   *
+   * Event handlers taking array_view_t instead of array_t receive the
+   * array inside libwayland's connection buffer without copying it. The
+   * view is only valid for the duration of the handler; use to_vector()
+   * to keep the contents. A byte view can be reinterpreted as a view of
+   * another element type, e.g. array_view_t<uint32_t>(bytes).
+   *
+   * Requests and events take their array arguments as byte views, which
+   * can be created implicitly from an array_t, a std::vector or any other
+   * view. The referenced memory is copied only into the connection buffer.
+   */
+  template <typename T>
+  class array_view_t
+  {
+  private:
+    static_assert(std::is_trivially_copyable<T>::value, "Array elements must be trivially copyable");
+
+    // borrowed memory, passed to libwayland as is
+    wl_array arr = { 0, 0, nullptr };
+
+    void assign(const void *data, std::size_t bytes)
+    {
+      if(bytes % sizeof(T) != 0)
+        throw std::invalid_argument("Array size is not a multiple of the element size.");
+      if(reinterpret_cast<std::uintptr_t>(data) % alignof(T) != 0)
+        throw std::invalid_argument("Array data is not aligned for the element type.");
+      arr.size = bytes;
+      arr.data = const_cast<void*>(data);
+    }
+
+  public:
+    array_view_t() = default;
+
+    array_view_t(const T *data, std::size_t size)
+    {
+      arr.size = size * sizeof(T);
+      arr.data = const_cast<T*>(data);
+    }
+
+    array_view_t(const std::vector<T> &v)
+      : array_view_t(v.data(), v.size())
+    {
+    }
+
+    /** \brief Byte view of a vector of any element type
+     */
+    template <typename U>
+    array_view_t(const std::vector<U> &v,
+                 typename std::enable_if<std::is_same<T, std::uint8_t>::value && !std::is_same<U, T>::value, int>::type = 0)
+    {
+      static_assert(std::is_trivially_copyable<U>::value, "Array elements must be trivially copyable");
+      arr.size = v.size() * sizeof(U);
+      arr.data = const_cast<U*>(v.data());
+    }
+
+    /** \brief View the contents of an array_t
+     *
+     * \exception std::invalid_argument if the size or alignment of the
+     *            array does not fit the element type
+     */
+    array_view_t(const array_t &arr);
+
+    /** \brief View the contents of a wl_array
+     *
+     * \exception std::invalid_argument if the size or alignment of the
+     *            array does not fit the element type
+     */
+    explicit array_view_t(const wl_array *arr)
+    {
+      if(arr && arr->size)
+        assign(arr->data, arr->size);
+    }
+
+    /** \brief Reinterpret a view with another element type
+     *
+     * \exception std::invalid_argument if the size or alignment of the
+     *            view does not fit the element type
+     */
+    template <typename U, typename V = T>
+    explicit array_view_t(const array_view_t<U> &other,
+                          typename std::enable_if<!std::is_same<V, std::uint8_t>::value, int>::type = 0)
+    {
+      if(!other.empty())
+        assign(other.data(), other.size_bytes());
+    }
+
+    /** \brief Byte view of a view with any element type
+     */
+    template <typename U, typename V = T>
+    array_view_t(const array_view_t<U> &other,
+                 typename std::enable_if<std::is_same<V, std::uint8_t>::value, int>::type = 0)
+    {
+      arr.size = other.size_bytes();
+      arr.data = const_cast<U*>(other.data());
+    }
+
+    const T *data() const
+    {
+      return static_cast<const T*>(arr.data);
+    }
+
+    std::size_t size() const
+    {
+      return arr.size / sizeof(T);
+    }
+
+    std::size_t size_bytes() const
+    {
+      return arr.size;
+    }
+
+    bool empty() const
+    {
+      return arr.size == 0;
+    }
+
+    const T *begin() const
+    {
+      return data();
+    }
+
+    const T *end() const
+    {
+      return data() + size();
+    }
+
+    const T &operator[](std::size_t idx) const
+    {
+      return data()[idx];
+    }
+
+    std::vector<T> to_vector() const
+    {
+      return std::vector<T>(begin(), end());
+    }
+
+    /** \brief Get the viewed memory as wl_array, for marshalling
+     */
+    const wl_array *c_ptr() const
+    {
+      return &arr;
+    }
+  };
+
   class array_t
   {
   private:
@@ -476,9 +1145,22 @@ namespace wayland
     array_t(wl_array *arr);
     void get(wl_array *arr) const;
 
+    // replace the contents with a single copy of the viewed memory
+    template <typename T> void assign(const array_view_t<T> &v)
+    {
+      a.size = 0;
+      if(v.empty())
+        return;
+      void *p = wl_array_add(&a, v.size_bytes());
+      if(!p)
+        throw std::bad_alloc();
+      std::memcpy(p, v.data(), v.size_bytes());
+    }
+
     friend class proxy_t;
     friend class detail::argument_t;
     friend class server::resource_t;
+    friend wl_argument detail::wire_argument(const array_t &arr);
 
   public:
     array_t();
@@ -488,11 +1170,15 @@ namespace wayland
     template <typename T> array_t(const std::vector<T> &v)
     {
       wl_array_init(&a);
-      wl_array_add(&a, v.size()*sizeof(T));
-      T *p = nullptr;
-      unsigned int c = 0;
-      wl_array_for_each_cpp(p, &a)
-        *p = v.at(c++);
+      assign(array_view_t<T>(v));
+    }
+
+    /** \brief Copy the contents of a view
+     */
+    template <typename T> explicit array_t(const array_view_t<T> &v)
+    {
+      wl_array_init(&a);
+      assign(v);
     }
 
     ~array_t();
@@ -501,24 +1187,382 @@ namespace wayland
 
     template <typename T> array_t &operator=(const std::vector<T> &v)
     {
-      wl_array_release(&a);
-      wl_array_init(&a);
-      wl_array_add(&a, v.size()*sizeof(T));
-      T *p = nullptr;
-      unsigned int c = 0;
-      wl_array_for_each_cpp(p, &a)
-        *p = v.at(c++);
+      assign(array_view_t<T>(v));
       return *this;
     }
 
     template <typename T> operator std::vector<T>() const
     {
-      std::vector<T> v;
-      T *p = nullptr;
-      wl_array_for_each_cpp(p, &a)
-        v.push_back(*p);
+      static_assert(std::is_trivially_copyable<T>::value, "Array elements must be trivially copyable");
+      std::vector<T> v(a.size / sizeof(T));
+      if(!v.empty())
+        std::memcpy(v.data(), a.data, v.size() * sizeof(T));
       return v;
     }
+
+    /** \brief View the contents without copying
+     *
+     * The view is invalidated when the array is modified or destroyed.
+     */
+    template <typename T = std::uint8_t> array_view_t<T> view() const
+    {
+      return array_view_t<T>(&a);
+    }
+  };
+
+  template <typename T>
+  array_view_t<T>::array_view_t(const array_t &arr)
+    : array_view_t(arr.view<T>())
+  {
+  }
+
+  template <typename Signature>
+  class handler_t;
+
+  /** \brief Lightweight event handler
+   *
+   * A replacement for std::function, which the scanner uses for the
+   * on_*() accessors if it is run with "-f handler". Callables of up to
+   * six pointers are stored inline, so that only larger ones allocate, and
+   * calling the handler is a single indirect call. Member functions can
+   * be bound to an object without any allocation:
+   * \code
+   * pointer.on_motion().bind<my_handler, &my_handler::motion>(this);
+   * \endcode
+   * With C++17 the class may be omitted: bind<&my_handler::motion>(this).
+   * The object is not owned by the handler and has to outlive it.
+   */
+  template <typename R, typename... Args>
+  class handler_t<R(Args...)>
+  {
+  private:
+    struct alignas(std::max_align_t) storage_t
+    {
+      unsigned char data[6 * sizeof(void*)];
+    };
+
+    // Copying, moving and destroying the stored callable. Callables which
+    // are stored inline and are trivially copyable need none of this.
+    struct ops_t
+    {
+      void (*copy)(storage_t &dst, const storage_t &src);
+      // also destroys src
+      void (*move)(storage_t &dst, storage_t &src);
+      void (*destroy)(storage_t &s);
+    };
+
+    template <typename F>
+    struct inline_ops
+    {
+      static F &get(storage_t &s)
+      {
+        return *reinterpret_cast<F*>(&s);
+      }
+
+      static R invoke(storage_t &s, Args... args)
+      {
+        return get(s)(std::forward<Args>(args)...);
+      }
+
+      static void copy(storage_t &dst, const storage_t &src)
+      {
+        new(&dst) F(*reinterpret_cast<const F*>(&src));
+      }
+
+      static void move(storage_t &dst, storage_t &src)
+      {
+        new(&dst) F(std::move(get(src)));
+        get(src).~F();
+      }
+
+      static void destroy(storage_t &s)
+      {
+        get(s).~F();
+      }
+
+      static const ops_t *table()
+      {
+        static const ops_t ops = {copy, move, destroy};
+        return std::is_trivially_copyable<F>::value ? nullptr : &ops;
+      }
+    };
+
+    template <typename F>
+    struct heap_ops
+    {
+      static F *&get(storage_t &s)
+      {
+        return *reinterpret_cast<F**>(&s);
+      }
+
+      static R invoke(storage_t &s, Args... args)
+      {
+        return (*get(s))(std::forward<Args>(args)...);
+      }
+
+      static void copy(storage_t &dst, const storage_t &src)
+      {
+        new(&dst) F*(new F(**reinterpret_cast<F* const*>(&src)));
+      }
+
+      static void move(storage_t &dst, storage_t &src)
+      {
+        new(&dst) F*(get(src));
+      }
+
+      static void destroy(storage_t &s)
+      {
+        delete get(s);
+      }
+
+      static const ops_t *table()
+      {
+        static const ops_t ops = {copy, move, destroy};
+        return &ops;
+      }
+    };
+
+    template <typename C, R (C::*method)(Args...)>
+    static R invoke_member(storage_t &s, Args... args)
+    {
+      return ((*reinterpret_cast<C**>(&s))->*method)(std::forward<Args>(args)...);
+    }
+
+    template <typename C, R (C::*method)(Args...) const>
+    static R invoke_const_member(storage_t &s, Args... args)
+    {
+      return ((*reinterpret_cast<const C**>(&s))->*method)(std::forward<Args>(args)...);
+    }
+
+    template <typename F>
+    using fits_inline = std::integral_constant<bool, sizeof(F) <= sizeof(storage_t)
+                                               && alignof(F) <= alignof(storage_t)
+                                               && std::is_nothrow_move_constructible<F>::value>;
+
+    // empty function pointers and std::functions result in an empty handler
+    template <typename F>
+    static bool is_null(const F & /*unused*/)
+    {
+      return false;
+    }
+
+    template <typename S>
+    static bool is_null(S *f)
+    {
+      return f == nullptr;
+    }
+
+    template <typename S>
+    static bool is_null(const std::function<S> &f)
+    {
+      return !f;
+    }
+
+    R (*invoker)(storage_t&, Args...) = nullptr;
+    const ops_t *ops = nullptr;
+    mutable storage_t storage;
+
+    template <typename F>
+    void assign(F &&f, std::true_type /*inline*/)
+    {
+      using T = typename std::decay<F>::type;
+      new(&storage) T(std::forward<F>(f));
+      invoker = &inline_ops<T>::invoke;
+      ops = inline_ops<T>::table();
+    }
+
+    template <typename F>
+    void assign(F &&f, std::false_type /*inline*/)
+    {
+      using T = typename std::decay<F>::type;
+      new(&storage) T*(new T(std::forward<F>(f)));
+      invoker = &heap_ops<T>::invoke;
+      ops = heap_ops<T>::table();
+    }
+
+    void copy_from(const handler_t &other)
+    {
+      if(!other.invoker)
+        return;
+      if(other.ops)
+        other.ops->copy(storage, other.storage);
+      else
+        storage = other.storage;
+      invoker = other.invoker;
+      ops = other.ops;
+    }
+
+    void move_from(handler_t &other) noexcept
+    {
+      if(!other.invoker)
+        return;
+      if(other.ops)
+        other.ops->move(storage, other.storage);
+      else
+        storage = other.storage;
+      invoker = other.invoker;
+      ops = other.ops;
+      other.invoker = nullptr;
+      other.ops = nullptr;
+    }
+
+    void reset() noexcept
+    {
+      if(ops)
+        ops->destroy(storage);
+      invoker = nullptr;
+      ops = nullptr;
+    }
+
+  public:
+    handler_t() noexcept = default;
+
+    handler_t(std::nullptr_t /*unused*/) noexcept
+    {
+    }
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, handler_t>::value>::type,
+              typename = decltype(std::declval<typename std::decay<F>::type&>()(std::declval<Args>()...))>
+    handler_t(F &&f)
+    {
+      if(!is_null(f))
+        assign(std::forward<F>(f), fits_inline<typename std::decay<F>::type>());
+    }
+
+    handler_t(const handler_t &other)
+    {
+      copy_from(other);
+    }
+
+    handler_t(handler_t &&other) noexcept
+    {
+      move_from(other);
+    }
+
+    ~handler_t()
+    {
+      reset();
+    }
+
+    handler_t &operator=(const handler_t &other)
+    {
+      if(&other != this)
+      {
+        handler_t tmp(other);
+        reset();
+        move_from(tmp);
+      }
+      return *this;
+    }
+
+    handler_t &operator=(handler_t &&other) noexcept
+    {
+      if(&other != this)
+      {
+        reset();
+        move_from(other);
+      }
+      return *this;
+    }
+
+    handler_t &operator=(std::nullptr_t /*unused*/) noexcept
+    {
+      reset();
+      return *this;
+    }
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, handler_t>::value>::type,
+              typename = decltype(std::declval<typename std::decay<F>::type&>()(std::declval<Args>()...))>
+    handler_t &operator=(F &&f)
+    {
+      handler_t tmp(std::forward<F>(f));
+      reset();
+      move_from(tmp);
+      return *this;
+    }
+
+    /** \brief Bind a member function to an object
+     *
+     * \tparam C class of the object
+     * \tparam method member function to call
+     * \param object object to call the member function on, not owned
+     */
+    template <typename C, R (C::*method)(Args...)>
+    handler_t &bind(C *object) noexcept
+    {
+      reset();
+      new(&storage) C*(object);
+      invoker = &invoke_member<C, method>;
+      return *this;
+    }
+
+    /** \brief Bind a const member function to an object
+     *
+     * \tparam C class of the object
+     * \tparam method member function to call
+     * \param object object to call the member function on, not owned
+     */
+    template <typename C, R (C::*method)(Args...) const>
+    handler_t &bind(const C *object) noexcept
+    {
+      reset();
+      new(&storage) const C*(object);
+      invoker = &invoke_const_member<C, method>;
+      return *this;
+    }
+
+#if __cplusplus >= 201703L
+    /** \brief Bind a member function to an object, deducing the class
+     *
+     * \tparam method member function to call
+     * \param object object to call the member function on, not owned
+     */
+    template <auto method, typename C>
+    handler_t &bind(C *object) noexcept
+    {
+      return bind<typename std::remove_const<C>::type, method>(object);
+    }
+#endif
+
+    /** \brief Check whether a callable is set
+     */
+    explicit operator bool() const noexcept
+    {
+      return invoker != nullptr;
+    }
+
+    /** \brief Call the handler
+     *
+     * \exception std::bad_function_call if the handler is empty
+     */
+    R operator()(Args... args) const
+    {
+      if(!invoker)
+        throw std::bad_function_call();
+      return invoker(storage, std::forward<Args>(args)...);
+    }
+
+    friend bool operator==(const handler_t &h, std::nullptr_t /*unused*/) noexcept
+    {
+      return !h;
+    }
+
+    friend bool operator==(std::nullptr_t /*unused*/, const handler_t &h) noexcept
+    {
+      return !h;
+    }
+
+    friend bool operator!=(const handler_t &h, std::nullptr_t /*unused*/) noexcept
+    {
+      return static_cast<bool>(h);
+    }
+
+    friend bool operator!=(std::nullptr_t /*unused*/, const handler_t &h) noexcept
+    {
+      return static_cast<bool>(h);
+    }
   };
 }
 
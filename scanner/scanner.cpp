@@ -32,6 +32,15 @@ using namespace pugi;
 
 std::list<std::string> interface_names;
 
+// store event handlers in a detail::handler_table_t instead of one std::function each
+bool sparse_handlers = false;
+
+// type of the event handlers, std::function or wayland::handler_t
+std::string handler_type = "std::function";
+
+// generate on_*_view() handlers with borrowed strings and arrays
+bool view_handlers = false;
+
 struct element_t
 {
   std::string name;
@@ -51,6 +60,7 @@ struct argument_t : public element_t
 {
   std::string type;
   std::string interface;
+  std::string orig_interface;
   std::string enum_iface;
   std::string enum_name;
   bool allow_null = false;
@@ -65,7 +75,8 @@ struct argument_t : public element_t
     throw std::runtime_error("Enum type must be int or uint");
   }
 
-  std::string print_type(bool server) const
+  // view: pass strings and arrays as borrowed string_view_t and array_view_t
+  std::string print_type(bool server, bool view = false) const
   {
     auto name_space = server ? "wayland::server::" : "wayland::";
     if(!interface.empty())
@@ -79,7 +90,7 @@ struct argument_t : public element_t
     if(type == "fixed")
       return "double";
     if(type == "string")
-      return "std::string";
+      return view ? "wayland::string_view_t" : "std::string";
     if(type == "object")
       return server ? "resource_t" : "proxy_t";
     if(type == "new_id")
@@ -87,7 +98,7 @@ struct argument_t : public element_t
     if(type == "fd")
       return "int";
     if(type == "array")
-      return "array_t";
+      return view ? "wayland::array_view_t<>" : "array_t";
     return type;
   }
 
@@ -112,9 +123,66 @@ struct argument_t : public element_t
     return "x";
   }
 
+  // arrays are borrowed from the caller, so any contiguous memory can be sent without copying
   std::string print_argument(bool server) const
   {
-    return print_type(server) + (!interface.empty() || !enum_iface.empty() || type == "string" || type == "array" ? " const& " : " ") + sanitise(name);
+    if(type == "array")
+      return print_type(server, true) + " const& " + sanitise(name);
+    return print_type(server) + (!interface.empty() || !enum_iface.empty() || type == "string" ? " const& " : " ") + sanitise(name);
+  }
+
+  // number of wl_arguments this argument occupies on the wire
+  int wire_count() const
+  {
+    // new_id without interface is sent as (interface name, version, id)
+    if(type == "new_id" && interface.empty())
+      return 3;
+    return 1;
+  }
+
+  // converts the wl_argument at index idx into the handler parameter type
+  std::string print_from_wire(int idx, bool server, bool view = false) const
+  {
+    std::string a = "args[" + std::to_string(idx) + "]";
+    if(!enum_name.empty() && type != "array")
+      return print_type(server) + "(" + a + (type == "int" ? ".i" : ".u") + ")";
+    if(type == "int")
+      return a + ".i";
+    if(type == "uint")
+      return a + ".u";
+    if(type == "fixed")
+      return "wl_fixed_to_double(" + a + ".f)";
+    if(type == "fd")
+      return a + ".h";
+    if(type == "string")
+      return view ? "wayland::string_view_t(" + a + ".s)" : "std::string(" + a + ".s ? " + a + ".s : \"\")";
+    if(type == "array")
+    {
+      if(view)
+        return "wayland::array_view_t<>(" + a + ".a)";
+      return (server ? "resource_t" : "proxy_t") + std::string("::array_argument(") + a + ".a)";
+    }
+    if(type == "object")
+    {
+      // Wrap the native pointer directly, without a temporary proxy_t. The
+      // wrapper still owns a reference, as handlers take it by value.
+      if(!server && !interface.empty() && interface != "display")
+        return print_type(server) + "(reinterpret_cast<" + orig_interface + "*>(" + a + ".o))";
+      std::string obj = server ? "resource_t::object_argument(" + a + ".o)"
+                               : "proxy_t(reinterpret_cast<wl_proxy*>(" + a + ".o))";
+      if(interface.empty())
+        return obj;
+      return print_type(server) + "(" + obj + ")";
+    }
+    if(type == "new_id")
+    {
+      if(interface.empty())
+        return server ? "resource_t()" : "proxy_t::new_id_argument(" + a + ".o)";
+      if(server)
+        return print_type(server) + "(resource_t::new_id_argument(target, &" + interface + "_interface, " + a + ".n))";
+      return print_type(server) + "(proxy_t::new_id_argument(" + a + ".o))";
+    }
+    throw std::runtime_error("Unknown argument type " + type);
   }
 };
 
@@ -124,79 +192,134 @@ struct event_t : public element_t
   int since = 0;
   argument_t ret;
   int opcode = 0;
+  // index of the first handler in the handler table of the interface
+  int handler_index = 0;
 
-  std::string print_functional(bool server) const
+  // whether an additional handler with borrowed strings and arrays is generated
+  bool has_borrowed_argument() const
+  {
+    if(!view_handlers)
+      return false;
+    for(auto const& arg : args)
+      if(arg.type == "string" || arg.type == "array")
+        return true;
+    return false;
+  }
+
+  std::string handler_name(bool view) const
+  {
+    return sanitise(name) + (view ? "_view" : "");
+  }
+
+  // number of handlers, i.e. entries in the handler table
+  int handler_count() const
+  {
+    return has_borrowed_argument() ? 2 : 1;
+  }
+
+  int handler_slot(bool view) const
+  {
+    return handler_index + (view ? 1 : 0);
+  }
+
+  std::string print_function_type(bool server, bool view) const
   {
     std::stringstream ss;
-    ss << "    std::function<void(";
+    ss << handler_type << "<void(";
     for(auto const& arg : args)
-      ss << arg.print_type(server) << ", ";
+      ss << arg.print_type(server, view) << ", ";
     if(!args.empty())
       ss.str(ss.str().substr(0, ss.str().size()-2));
     ss.seekp(0, std::ios_base::end);
-    ss << ")> " << sanitise(name) << ";";
+    ss << ")>";
     return ss.str();
   }
 
-  std::string print_dispatcher(int opcode, bool server) const
+  std::string print_functional(bool server, bool view = false) const
+  {
+    return "    " + print_function_type(server, view) + " " + handler_name(view) + ";";
+  }
+
+  // expression referring to a handler of the events_t pointed to by events
+  std::string print_handler(bool view) const
+  {
+    if(sparse_handlers)
+      return view ? "(*view_handler)" : "(*handler)";
+    return "events->" + handler_name(view);
+  }
+
+  // condition which is true if the handler is set
+  std::string print_handler_condition(bool server, bool view) const
+  {
+    if(sparse_handlers)
+      return std::string(view ? "auto *view_handler" : "auto *handler") + " = events->handlers.find<" + print_function_type(server, view) + ">("
+        + std::to_string(handler_slot(view)) + ")";
+    return "events->" + handler_name(view);
+  }
+
+  std::string print_handler_call(bool server, bool view) const
   {
     std::stringstream ss;
-    ss << "    case " << opcode << ":" << std::endl
-       << "      if(events->" << sanitise(name) << ") events->" << sanitise(name) << "(";
+    ss << print_handler(view) << "(";
 
     int c = 0;
     for(auto const& arg : args)
-      if(!arg.enum_name.empty() && arg.type != "array")
-        ss << arg.print_type(server) << "(args[" << c++ << "].get<" << arg.print_enum_wire_type() << ">()), ";
-      else if(!arg.interface.empty())
-      {
-        if(server)
-          ss << arg.print_type(server) << "(args[" << c++ << "].get<resource_t>()), ";
-        else
-          ss << arg.print_type(server) << "(args[" << c++ << "].get<proxy_t>()), ";
-      }
-      else
-        ss << "args[" << c++ << "].get<" << arg.print_type(server) << ">(), ";
+    {
+      // the actual id is the last of the wire arguments
+      c += arg.wire_count() - 1;
+      ss << arg.print_from_wire(c++, server, view) << ", ";
+    }
     if(!args.empty())
       ss.str(ss.str().substr(0, ss.str().size()-2));
     ss.seekp(0, std::ios_base::end);
-    ss << ");" << std::endl
-       << "      break;";
+    ss << ");";
     return ss.str();
   }
 
-  std::string print_signal_header(bool server) const
+  std::string print_dispatcher(int opcode, bool server) const
+  {
+    std::stringstream ss;
+    ss << "    case " << opcode << ":" << std::endl;
+    if(has_borrowed_argument())
+      ss << "      if(" << print_handler_condition(server, true) << ") " << print_handler_call(server, true) << std::endl
+         << "      else if(" << print_handler_condition(server, false) << ") " << print_handler_call(server, false) << std::endl;
+    else
+      ss << "      if(" << print_handler_condition(server, false) << ") " << print_handler_call(server, false) << std::endl;
+    ss << "      break;";
+    return ss.str();
+  }
+
+  std::string print_signal_header(bool server, bool view = false) const
   {
     std::stringstream ss;
     ss << "  /** \\brief " << summary << std::endl;
     for(auto const& arg : args)
       ss << "      \\param " << arg.name << " " << arg.summary << std::endl;
-    ss << description << std::endl
-       << "  */" << std::endl;
+    if(view)
+      ss << std::endl
+         << "      Like \\ref on_" << name << ", but strings and arrays are passed as string_view_t" << std::endl
+         << "      and array_view_t referring to the connection buffer, which are only valid" << std::endl
+         << "      during the call. If set, this handler is called instead of \\ref on_" << name << "." << std::endl
+         << "  */" << std::endl;
+    else
+      ss << description << std::endl
+         << "  */" << std::endl;
 
-    ss << "  std::function<void(";
-    for(auto const& arg : args)
-      ss << arg.print_type(server) + ", ";
-    if(!args.empty())
-      ss.str(ss.str().substr(0, ss.str().size()-2));
-    ss.seekp(0, std::ios_base::end);
-    ss << ")> &on_" <<  name << "();" << std::endl;
+    ss << "  " << print_function_type(server, view) << " &on_" << name << (view ? "_view" : "") << "();" << std::endl;
     return ss.str();
   }
 
-  std::string print_signal_body(const std::string& interface_name, bool server) const
+  std::string print_signal_body(const std::string& interface_name, bool server, bool view = false) const
   {
     std::stringstream ss;
-    ss << "std::function<void(";
-    for(auto const& arg : args)
-      ss << arg.print_type(server) << ", ";
-    if(!args.empty())
-      ss.str(ss.str().substr(0, ss.str().size()-2));
-    ss.seekp(0, std::ios_base::end);
-    ss << ")> &" + interface_name + "_t::on_" + name + "()" << std::endl
-       << "{" << std::endl
-       << "  return std::static_pointer_cast<events_t>(get_events())->" + sanitise(name) + ";" << std::endl
-       << "}" << std::endl;
+    ss << print_function_type(server, view) << " &" + interface_name + "_t::on_" + name + (view ? "_view" : "") + "()" << std::endl
+       << "{" << std::endl;
+    if(sparse_handlers)
+      ss << "  return std::static_pointer_cast<events_t>(get_events())->handlers.get<" << print_function_type(server, view) << ">("
+         << handler_slot(view) << ");" << std::endl;
+    else
+      ss << "  return std::static_pointer_cast<events_t>(get_events())->" + handler_name(view) + ";" << std::endl;
+    ss << "}" << std::endl;
     return ss.str();
   }
 
@@ -212,6 +335,137 @@ struct event_t : public element_t
     return name + "_since_version";
   }
 
+  // arguments passed to marshal() or send_event(), each followed by ", "
+  std::string print_wire_arguments() const
+  {
+    std::stringstream ss;
+    for(auto const& arg : args)
+    {
+      if(arg.type == "new_id")
+      {
+        if(arg.interface.empty())
+          ss << "std::string(interface.interface->name), version, ";
+        ss << "nullptr, ";
+      }
+      else if(arg.type == "fd")
+        ss << "wayland::detail::argument_t::fd(" << sanitise(arg.name) << "), ";
+      else if(arg.type == "object")
+        ss << sanitise(arg.name) << ".proxy_has_object() ? reinterpret_cast<wl_object*>(" << sanitise(arg.name) << ".c_ptr()) : nullptr, ";
+      else if(!arg.enum_name.empty())
+        ss << "static_cast<" << arg.print_enum_wire_type() << ">(" << sanitise(arg.name) + "), ";
+      else
+        ss << sanitise(arg.name) + ", ";
+    }
+    return ss.str();
+  }
+
+  // Events creating new objects cannot be sent to more than one resource.
+  // Neither can events referring to objects, since object ids are only
+  // valid for the client owning the object.
+  bool can_multicast() const
+  {
+    for(auto const& arg : args)
+      if(arg.type == "new_id" || arg.type == "object")
+        return false;
+    return true;
+  }
+
+  std::string multicast_function_name() const
+  {
+    return "multicast_" + name;
+  }
+
+  std::string print_multicast_header() const
+  {
+    std::stringstream ss;
+    ss << "  /** \\brief Post the \\ref " << sanitise(name) << " event to several resources" << std::endl
+       << "      \\param resources Range of resources to send the event to" << std::endl;
+    for(auto const& arg : args)
+      ss << "      \\param " << sanitise(arg.name) << " " << arg.summary << std::endl;
+    ss << std::endl
+       << "      The arguments are converted only once. Resources bound with a version" << std::endl
+       << "      lower than " << since_version_constant_name() << " are skipped." << std::endl
+       << "  */" << std::endl
+       << "  template <typename R>" << std::endl
+       << "  static void " << multicast_function_name() << "(const R &resources, ";
+    for(auto const& arg : args)
+      ss << arg.print_argument(true) << ", ";
+    ss << "bool post = true);" << std::endl;
+    return ss.str();
+  }
+
+  // defined after all classes, since enum arguments are declared after the class
+  std::string print_multicast_body(const std::string& interface_name) const
+  {
+    std::stringstream ss;
+    ss << "template <typename R>" << std::endl
+       << "void " << interface_name << "_t::" << multicast_function_name() << "(const R &resources, ";
+    for(auto const& arg : args)
+      ss << arg.print_argument(true) << ", ";
+    ss << "bool post)" << std::endl
+       << "{" << std::endl
+       << "  multicast_event(resources, post, " << opcode << ", " << since_version_constant_name() << ", ";
+    ss << print_wire_arguments();
+    ss.str(ss.str().substr(0, ss.str().size()-2));
+    ss.seekp(0, std::ios_base::end);
+    ss << ");" << std::endl
+       << "}" << std::endl;
+    return ss.str();
+  }
+
+  // requests creating a wl_callback also get an awaitable *_async() variant
+  bool returns_callback() const
+  {
+    return !ret.name.empty() && ret.orig_interface == "wl_callback";
+  }
+
+  std::string print_async_parameters() const
+  {
+    std::stringstream ss;
+    for(auto const& arg : args)
+      if(arg.type != "new_id")
+        ss << arg.print_argument(false) << ", ";
+    std::string str = ss.str();
+    return str.empty() ? str : str.substr(0, str.size()-2);
+  }
+
+  std::string print_async_header() const
+  {
+    std::stringstream ss;
+    ss << "#ifdef WAYLANDPP_COROUTINES" << std::endl
+       << "  /** \\brief Like \\ref " << sanitise(name) << ", but returns an awaitable for the done event" << std::endl;
+    for(auto const& arg : args)
+      if(arg.type != "new_id")
+        ss << "      \\param " << sanitise(arg.name) << " " << arg.summary << std::endl;
+    ss << std::endl
+       << "      Only available with C++20 coroutines, see callback_awaitable_t." << std::endl
+       << "  */" << std::endl
+       << "  wayland::callback_awaitable_t<callback_t> " << sanitise(name) << "_async(" << print_async_parameters() << ");" << std::endl
+       << "#endif" << std::endl;
+    return ss.str();
+  }
+
+  // defined after all classes, since callback_t may not be complete in the class
+  std::string print_async_body(const std::string& interface_name) const
+  {
+    std::stringstream ss;
+    ss << "#ifdef WAYLANDPP_COROUTINES" << std::endl
+       << "inline wayland::callback_awaitable_t<callback_t> " << interface_name << "_t::" << sanitise(name) << "_async("
+       << print_async_parameters() << ")" << std::endl
+       << "{" << std::endl
+       << "  return wayland::callback_awaitable_t<callback_t>(" << sanitise(name) << "(";
+    std::string call;
+    for(auto const& arg : args)
+      if(arg.type != "new_id")
+        call += sanitise(arg.name) + ", ";
+    if(!call.empty())
+      call = call.substr(0, call.size()-2);
+    ss << call << "));" << std::endl
+       << "}" << std::endl
+       << "#endif" << std::endl;
+    return ss.str();
+  }
+
   std::string print_header(bool server) const
   {
     std::stringstream ss;
@@ -316,23 +570,7 @@ struct event_t : public element_t
       ss << "  proxy_t p = marshal_constructor(" << opcode << "U, &" << ret.interface << "_interface, ";
     }
 
-    for(auto const& arg : args)
-    {
-      if(arg.type == "new_id")
-      {
-        if(arg.interface.empty())
-          ss << "std::string(interface.interface->name), version, ";
-        ss << "nullptr, ";
-      }
-      else if(arg.type == "fd")
-        ss << "argument_t::fd(" << sanitise(arg.name) << "), ";
-      else if(arg.type == "object")
-        ss << sanitise(arg.name) << ".proxy_has_object() ? reinterpret_cast<wl_object*>(" << sanitise(arg.name) << ".c_ptr()) : nullptr, ";
-      else if(!arg.enum_name.empty())
-        ss << "static_cast<" << arg.print_enum_wire_type() << ">(" << sanitise(arg.name) + "), ";
-      else
-        ss << sanitise(arg.name) + ", ";
-    }
+    ss << print_wire_arguments();
 
     ss.str(ss.str().substr(0, ss.str().size()-2));
     ss.seekp(0, std::ios_base::end);
@@ -476,6 +714,26 @@ struct interface_t : public element_t
   std::list<enumeration_t> enums;
   std::list<post_error_t> errors;
 
+  template <typename T>
+  static void assign_handler_indices(std::list<T> &elements)
+  {
+    int index = 0;
+    for(auto &element : elements)
+    {
+      element.handler_index = index;
+      index += element.handler_count();
+    }
+  }
+
+  template <typename T>
+  static std::string print_handler_table(const std::list<T> &elements)
+  {
+    int count = 0;
+    for(auto const& element : elements)
+      count += element.handler_count();
+    return "    wayland::detail::handler_table_t<" + std::to_string(count) + "> handlers;";
+  }
+
   std::string print_forward() const
   {
     std::stringstream ss;
@@ -505,12 +763,19 @@ struct interface_t : public element_t
        << "  struct events_t : public detail::events_base_t" << std::endl
        << "  {" << std::endl;
 
-    for(auto const& event : events)
-      ss << event.print_functional(false) << std::endl;
+    if(sparse_handlers && !events.empty())
+      ss << print_handler_table(events) << std::endl;
+    else
+      for(auto const& event : events)
+      {
+        ss << event.print_functional(false) << std::endl;
+        if(event.has_borrowed_argument())
+          ss << event.print_functional(false, true) << std::endl;
+      }
 
     ss << "  };" << std::endl
        << std::endl
-       << "  static int dispatcher(uint32_t opcode, const std::vector<detail::any>& args, const std::shared_ptr<detail::events_base_t>& e);" << std::endl
+       << "  static int dispatcher(uint32_t opcode, const wl_argument *args, const std::shared_ptr<detail::events_base_t>& e);" << std::endl
        << std::endl
        << "  " << name << "_t(proxy_t const &wrapped_proxy, construct_proxy_wrapper_tag /*unused*/);" << std::endl
        << std::endl;
@@ -531,10 +796,18 @@ struct interface_t : public element_t
 
     for(auto const& request : requests)
       if(request.name != "destroy")
+      {
         ss << request.print_header(false) << std::endl;
+        if(request.returns_callback())
+          ss << request.print_async_header() << std::endl;
+      }
 
     for(auto const& event : events)
+    {
       ss << event.print_signal_header(false) << std::endl;
+      if(event.has_borrowed_argument())
+        ss << event.print_signal_header(false, true) << std::endl;
+    }
 
     ss << "};" << std::endl
        << std::endl;
@@ -558,12 +831,19 @@ struct interface_t : public element_t
        << "  struct events_t : public resource_t::events_base_t" << std::endl
        << "  {" << std::endl;
 
-    for(auto const& request : requests)
-      ss << request.print_functional(true) << std::endl;
+    if(sparse_handlers && !requests.empty())
+      ss << print_handler_table(requests) << std::endl;
+    else
+      for(auto const& request : requests)
+      {
+        ss << request.print_functional(true) << std::endl;
+        if(request.has_borrowed_argument())
+          ss << request.print_functional(true, true) << std::endl;
+      }
 
     ss << "  };" << std::endl
        << std::endl
-       << "  static int dispatcher(int opcode, const std::vector<wayland::detail::any>& args, const std::shared_ptr<resource_t::events_base_t>& e);" << std::endl
+       << "  static int dispatcher(uint32_t opcode, wl_resource *target, const wl_argument *args, const std::shared_ptr<resource_t::events_base_t>& e);" << std::endl
        << std::endl;
 
     ss << "protected:" << std::endl
@@ -587,10 +867,18 @@ struct interface_t : public element_t
        << std::endl;
 
     for(auto const& request : requests)
+    {
       ss << request.print_signal_header(true) << std::endl;
+      if(request.has_borrowed_argument())
+        ss << request.print_signal_header(true, true) << std::endl;
+    }
 
     for(auto const& event : events)
+    {
       ss << event.print_header(true) << std::endl;
+      if(event.can_multicast())
+        ss << event.print_multicast_header() << std::endl;
+    }
 
     for(auto const& error : errors)
       ss << error.print_server_header() << std::endl;
@@ -616,9 +904,9 @@ struct interface_t : public element_t
   std::string print_client_body() const
   {
     std::stringstream set_events;
-    set_events << "  if(proxy_has_object() && get_wrapper_type() == wrapper_type::standard)" << std::endl
+    set_events << "  if(proxy_has_object() && get_wrapper_type() == wrapper_type::standard && !has_events())" << std::endl
                << "    {" << std::endl
-               << "      set_events(std::shared_ptr<detail::events_base_t>(new events_t), dispatcher);" << std::endl;
+               << "      set_events(detail::make_pooled<events_t>(), dispatcher);" << std::endl;
     if(destroy_opcode != -1)
       set_events << "      set_destroy_opcode(" << destroy_opcode << "U);" << std::endl;
     set_events << "    }" << std::endl;
@@ -675,14 +963,18 @@ struct interface_t : public element_t
            << std::endl;
 
     for(auto const& event : events)
+    {
       ss << event.print_signal_body(name, false) << std::endl;
+      if(event.has_borrowed_argument())
+        ss << event.print_signal_body(name, false, true) << std::endl;
+    }
 
-    ss << "int " << name << "_t::dispatcher(uint32_t opcode, const std::vector<any>& args, const std::shared_ptr<detail::events_base_t>& e)" << std::endl
+    ss << "int " << name << "_t::dispatcher(uint32_t opcode, const wl_argument *args, const std::shared_ptr<detail::events_base_t>& e)" << std::endl
        << "{" << std::endl;
 
     if(!events.empty())
     {
-      ss << "  std::shared_ptr<events_t> events = std::static_pointer_cast<events_t>(e);" << std::endl
+      ss << "  auto *events = static_cast<events_t*>(e.get());" << std::endl
          << "  switch(opcode)" << std::endl
          << "    {" << std::endl;
 
@@ -702,19 +994,39 @@ struct interface_t : public element_t
     return ss.str();
   }
 
+  std::string print_client_async_bodies() const
+  {
+    std::stringstream ss;
+    for(auto const& request : requests)
+      if(request.returns_callback())
+        ss << request.print_async_body(name) << std::endl;
+    return ss.str();
+  }
+
+  std::string print_server_multicast_bodies() const
+  {
+    std::stringstream ss;
+    for(auto const& event : events)
+      if(event.can_multicast())
+        ss << event.print_multicast_body(name) << std::endl;
+    return ss.str();
+  }
+
   std::string print_server_body() const
   {
     std::stringstream ss;
     ss << name << "_t::" << name << "_t(const client_t& client, uint32_t id, int version)" << std::endl
        << "  : resource_t(client, &server::detail::" << name << "_interface, id, version)" << std::endl
        << "{" << std::endl
-       << "  set_events(std::shared_ptr<resource_t::events_base_t>(new events_t), dispatcher);" << std::endl
+       << "  if(!has_events())" << std::endl
+       << "    set_events(wayland::detail::make_pooled<events_t>(), dispatcher);" << std::endl
        << "}" << std::endl
        << std::endl
        << name << "_t::" << name << "_t(const resource_t &resource)" << std::endl
        << "  : resource_t(resource)" << std::endl
        << "{" << std::endl
-       << "  set_events(std::shared_ptr<resource_t::events_base_t>(new events_t), dispatcher);" << std::endl
+       << "  if(!has_events())" << std::endl
+       << "    set_events(wayland::detail::make_pooled<events_t>(), dispatcher);" << std::endl
        << "}" << std::endl
        << std::endl
        << "const std::string " << name << "_t::interface_name = \"" << orig_name << "\";" << std::endl
@@ -728,8 +1040,13 @@ struct interface_t : public element_t
        << std::endl;
 
     for(auto const& request : requests)
+    {
       ss << request.print_signal_body(name, true) << std::endl
          << std::endl;
+      if(request.has_borrowed_argument())
+        ss << request.print_signal_body(name, true, true) << std::endl
+           << std::endl;
+    }
 
     for(auto const& event : events)
       ss << event.print_body(name, true) << std::endl;
@@ -737,12 +1054,12 @@ struct interface_t : public element_t
     for(auto const& error : errors)
       ss << error.print_server_body(name) << std::endl;
 
-    ss << "int " << name << "_t::dispatcher(int opcode, const std::vector<any>& args, const std::shared_ptr<resource_t::events_base_t>& e)" << std::endl
+    ss << "int " << name << "_t::dispatcher(uint32_t opcode, wl_resource *target, const wl_argument *args, const std::shared_ptr<resource_t::events_base_t>& e)" << std::endl
        << "{" << std::endl;
 
     if(!requests.empty())
     {
-      ss << "  std::shared_ptr<events_t> events = std::static_pointer_cast<events_t>(e);" << std::endl
+      ss << "  auto *events = static_cast<events_t*>(e.get());" << std::endl
          << "  switch(opcode)" << std::endl
          << "    {" << std::endl;
 
@@ -897,7 +1214,7 @@ int main(int argc, char *argv[])
   if(extra.size() < 3)
   {
     std::cerr << "Usage:" << std::endl
-              << "  " << argv[0] << " [-s on] [-x extra_header.hpp] protocol1.xml [protocol2.xml ...] protocol.hpp protocol.cpp" << std::endl;
+              << "  " << argv[0] << " [-s on] [-e sparse] [-f handler] [-v on] [-x extra_header.hpp] protocol1.xml [protocol2.xml ...] protocol.hpp protocol.cpp" << std::endl;
     return 1;
   }
 
@@ -910,6 +1227,45 @@ int main(int argc, char *argv[])
     return false;
   }();
 
+  // event handler storage
+  for(auto const& opt : map)
+    if(opt.key == "e")
+    {
+      if(opt.value == "sparse")
+        sparse_handlers = true;
+      else if(opt.value != "dense")
+      {
+        std::cerr << "Unknown event handler storage " << opt.value << std::endl;
+        return 1;
+      }
+    }
+
+  // event handler type
+  for(auto const& opt : map)
+    if(opt.key == "f")
+    {
+      if(opt.value == "handler")
+        handler_type = "wayland::handler_t";
+      else if(opt.value != "function")
+      {
+        std::cerr << "Unknown event handler type " << opt.value << std::endl;
+        return 1;
+      }
+    }
+
+  // view handlers
+  for(auto const& opt : map)
+    if(opt.key == "v")
+    {
+      if(opt.value == "on")
+        view_handlers = true;
+      else if(opt.value != "off")
+      {
+        std::cerr << "Unknown view handler setting " << opt.value << std::endl;
+        return 1;
+      }
+    }
+
   std::list<interface_t> interfaces;
   int enum_id = 0;
 
@@ -970,7 +1326,10 @@ int main(int argc, char *argv[])
             arg.summary = argument.attribute("summary").value();
 
           if(argument.attribute("interface"))
-            arg.interface = unprefix(argument.attribute("interface").value());
+          {
+            arg.orig_interface = argument.attribute("interface").value();
+            arg.interface = unprefix(arg.orig_interface);
+          }
 
           if(argument.attribute("enum"))
           {
@@ -1025,7 +1384,10 @@ int main(int argc, char *argv[])
             arg.summary = argument.attribute("summary").value();
 
           if(argument.attribute("interface"))
-            arg.interface = unprefix(argument.attribute("interface").value());
+          {
+            arg.orig_interface = argument.attribute("interface").value();
+            arg.interface = unprefix(arg.orig_interface);
+          }
 
           if(argument.attribute("enum"))
           {
@@ -1103,6 +1465,8 @@ int main(int argc, char *argv[])
         iface.enums.push_back(enu);
       }
 
+      interface_t::assign_handler_indices(iface.requests);
+      interface_t::assign_handler_indices(iface.events);
       interfaces.push_back(iface);
     }
   }
@@ -1197,11 +1561,24 @@ int main(int argc, char *argv[])
       else
         wayland_hpp << iface.print_client_header() << std::endl;
     }
+
+  // multicast templates, which need all classes to be complete
+  for(auto const& iface : interfaces)
+    if(iface.name != "display")
+      wayland_hpp << (server ? iface.print_server_multicast_bodies() : iface.print_client_async_bodies());
+
   wayland_hpp << std::endl
               << "}" << std::endl;
   if(server)
     wayland_hpp << "}" << std::endl;
 
+  // the coroutine support needs the complete registry_t and callback_t
+  if(!server)
+    for(auto const& iface : interfaces)
+      if(iface.orig_name == "wl_registry")
+        wayland_hpp << std::endl
+                    << "#include <wayland-client-coroutine.hpp>" << std::endl;
+
   // body intro
   auto hpp_slash_pos = hpp_file.find_last_of('/');
   auto hpp_basename = (hpp_slash_pos == std::string::npos ? hpp_file : hpp_file.substr(hpp_slash_pos + 1));
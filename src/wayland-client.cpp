@@ -27,9 +27,18 @@
 #include <cstdio>
 #include <cerrno>
 
-#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
 #include <limits>
+#include <mutex>
 #include <system_error>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 #include <wayland-client.hpp>
 #include <wayland-client-protocol.hpp>
 
@@ -76,14 +85,16 @@ namespace
 }
 
 // stored in the proxy user data
-struct wayland::detail::proxy_data_t
+struct wayland::detail::proxy_data_t : public pooled_t
 {
   std::shared_ptr<events_base_t> events;
   bool has_destroy_opcode{false};
   std::uint32_t destroy_opcode{};
-  std::atomic<unsigned int> counter{1};
+  refcount_t counter;
   event_queue_t queue;
   proxy_t wrapped_proxy;
+  // type of the proxy the data was created for
+  proxy_t::wrapper_type type{proxy_t::wrapper_type::standard};
 };
 
 void wayland::set_log_handler(log_handler handler)
@@ -113,16 +124,13 @@ int proxy_t::c_dispatcher(const void *implementation, void *target, uint32_t opc
   if(!wl_proxy_get_user_data(reinterpret_cast<wl_proxy*>(target)))
     return 0;
 
-  std::string signature(message->signature);
+  const message_signature_t &signature = message_signature(message);
   std::vector<any> vargs;
-  unsigned int c = 0;
-  for(char ch : signature)
+  vargs.reserve(signature.arity());
+  for(unsigned int c = 0; c < signature.arity(); c++)
   {
-    if(ch == '?' || isdigit(ch))
-      continue;
-
     any a;
-    switch(ch)
+    switch(signature.arguments[c].type)
     {
       // int_32_t
     case 'i':
@@ -178,8 +186,7 @@ int proxy_t::c_dispatcher(const void *implementation, void *target, uint32_t opc
       a = 0;
       break;
     }
-    vargs.push_back(a);
-    c++;
+    vargs.push_back(std::move(a));
   }
   proxy_t p(reinterpret_cast<wl_proxy*>(target), wrapper_type::standard);
   using dispatcher_func = int(*)(std::uint32_t, const std::vector<any>&, const std::shared_ptr<events_base_t>&);
@@ -187,28 +194,36 @@ int proxy_t::c_dispatcher(const void *implementation, void *target, uint32_t opc
   return dispatcher(opcode, vargs, p.get_events());
 }
 
-proxy_t proxy_t::marshal_single(uint32_t opcode, const wl_interface *interface, const std::vector<argument_t>& args, std::uint32_t version)
+proxy_t proxy_t::marshal_single(uint32_t opcode, const wl_interface *interface, wl_argument *args, std::uint32_t version)
 {
-  std::vector<wl_argument> v;
-  v.reserve(args.size());
-  for(auto const& arg : args)
-    v.push_back(arg.get_c_argument());
-  if(interface)
+#if WAYLAND_VERSION_MAJOR > 1 || WAYLAND_VERSION_MINOR > 19
+  // New proxies inherit the version of their parent, unless specified otherwise
+  if(version == 0)
+    version = wl_proxy_get_version(c_ptr());
+  wl_proxy *p = wl_proxy_marshal_array_flags(c_ptr(), opcode, interface, version, 0, args);
+  if(!interface)
+    return proxy_t();
+  if(!p)
+    throw std::runtime_error("wl_proxy_marshal_array_flags");
+#else
+  if(!interface)
   {
-    wl_proxy *p = nullptr;
-    if(version > 0)
-      p = wl_proxy_marshal_array_constructor_versioned(c_ptr(), opcode, v.data(), interface, version);
-    else
-      p = wl_proxy_marshal_array_constructor(c_ptr(), opcode, v.data(), interface);
-
-    if(!p)
-      throw std::runtime_error("wl_proxy_marshal_array_constructor");
-    wl_proxy_set_user_data(p, nullptr); // Wayland leaves the user data uninitialized
-    // libwayland-client inherits the queue, so we need to, too
-    return proxy_t(p, wrapper_type::standard, data ? data->queue : wayland::event_queue_t());
+    wl_proxy_marshal_array(c_ptr(), opcode, args);
+    return proxy_t();
   }
-  wl_proxy_marshal_array(proxy, opcode, v.data());
-  return proxy_t();
+
+  wl_proxy *p = nullptr;
+  if(version > 0)
+    p = wl_proxy_marshal_array_constructor_versioned(c_ptr(), opcode, args, interface, version);
+  else
+    p = wl_proxy_marshal_array_constructor(c_ptr(), opcode, args, interface);
+  if(!p)
+    throw std::runtime_error("wl_proxy_marshal_array_constructor");
+#endif
+
+  wl_proxy_set_user_data(p, nullptr); // Wayland leaves the user data uninitialized
+  // libwayland-client inherits the queue, so we need to, too
+  return proxy_t(p, wrapper_type::standard, data ? data->queue : wayland::event_queue_t());
 }
 
 void proxy_t::set_interface(const wl_interface *iface)
@@ -232,19 +247,81 @@ void proxy_t::set_destroy_opcode(uint32_t destroy_opcode)
   }
 }
 
-void proxy_t::set_events(std::shared_ptr<events_base_t> events,
-                         int(*dispatcher)(uint32_t, const std::vector<any>&, const std::shared_ptr<events_base_t> &))
+int proxy_t::c_typed_dispatcher(const void *implementation, void *target, uint32_t opcode, const wl_message *message, wl_argument *args)
+{
+  if(!implementation)
+    throw std::invalid_argument("proxy dispatcher: implementation is NULL.");
+  if(!target)
+    throw std::invalid_argument("proxy dispatcher: target is NULL.");
+  if(!message)
+    throw std::invalid_argument("proxy dispatcher: message is NULL.");
+
+  auto *proxy = reinterpret_cast<wl_proxy*>(target);
+  auto *data = reinterpret_cast<proxy_data_t*>(wl_proxy_get_user_data(proxy));
+  if(!data)
+    return 0;
+
+  data->counter.acquire();
+  // Hold a reference for the call without constructing a proxy_t. The
+  // handler may release the last other reference to its own proxy, possibly
+  // on another thread, in which case the proxy is destroyed afterwards.
+  struct dispatch_guard
+  {
+    wl_proxy *proxy;
+    proxy_data_t *data;
+
+    ~dispatch_guard()
+    {
+      if(data->counter.release())
+        proxy_t::destroy(proxy, data, data->type);
+    }
+  } guard{proxy, data};
+
+  using dispatcher_func = int(*)(std::uint32_t, const wl_argument*, const std::shared_ptr<events_base_t>&);
+  auto dispatcher = reinterpret_cast<dispatcher_func>(const_cast<void*>(implementation));
+  return dispatcher(opcode, args, data->events);
+}
+
+proxy_t proxy_t::new_id_argument(wl_object *o)
+{
+  if(!o)
+    return proxy_t();
+  auto *proxy = reinterpret_cast<wl_proxy*>(o);
+  wl_proxy_set_user_data(proxy, nullptr); // Wayland leaves the user data uninitialized
+  return proxy_t(proxy);
+}
+
+array_t proxy_t::array_argument(wl_array *a)
+{
+  if(a)
+    return array_t(a);
+  return array_t();
+}
+
+void proxy_t::add_dispatcher(std::shared_ptr<events_base_t> events, wl_dispatcher_func_t c_func, void *dispatcher)
 {
   // set only one time
   if(data && !data->events)
   {
     data->events = std::move(events);
     // the dispatcher gets 'implementation'
-    if(wl_proxy_add_dispatcher(c_ptr(), c_dispatcher, reinterpret_cast<void*>(dispatcher), data) < 0)
+    if(wl_proxy_add_dispatcher(c_ptr(), c_func, dispatcher, data) < 0)
       throw std::runtime_error("wl_proxy_add_dispatcher failed.");
   }
 }
 
+void proxy_t::set_events(std::shared_ptr<events_base_t> events,
+                         int(*dispatcher)(uint32_t, const std::vector<any>&, const std::shared_ptr<events_base_t> &))
+{
+  add_dispatcher(std::move(events), c_dispatcher, reinterpret_cast<void*>(dispatcher));
+}
+
+void proxy_t::set_events(std::shared_ptr<events_base_t> events,
+                         int(*dispatcher)(uint32_t, const wl_argument*, const std::shared_ptr<events_base_t> &))
+{
+  add_dispatcher(std::move(events), c_typed_dispatcher, reinterpret_cast<void*>(dispatcher));
+}
+
 std::shared_ptr<events_base_t> proxy_t::get_events()
 {
   if(data)
@@ -252,6 +329,11 @@ std::shared_ptr<events_base_t> proxy_t::get_events()
   return std::shared_ptr<events_base_t>();
 }
 
+bool proxy_t::has_events() const
+{
+  return data && data->events;
+}
+
 proxy_t::proxy_t(wl_proxy *p, wrapper_type t, event_queue_t const &queue)
   : proxy(p), type(t)
 {
@@ -267,10 +349,11 @@ proxy_t::proxy_t(wl_proxy *p, wrapper_type t, event_queue_t const &queue)
     {
       data = new proxy_data_t;
       data->queue = queue;
+      data->type = type;
       wl_proxy_set_user_data(c_ptr(), data);
     }
     else
-      ++data->counter;
+      data->counter.acquire();
   }
 }
 
@@ -301,7 +384,7 @@ proxy_t &proxy_t::operator=(const proxy_t& p)
   type = p.type;
 
   if(data)
-    data->counter++;
+    data->counter.acquire();
 
   // Allowed: nothing set (for standard wrapper, others may not be empty), proxy set & data unset (for foreign), proxy & data set (for everything but foreign)
   if(!((type == wrapper_type::standard && !data && !proxy) || (type == wrapper_type::foreign && !data && proxy) || ((type == wrapper_type::standard || type == wrapper_type::proxy_wrapper || type == wrapper_type::display) && data && proxy)))
@@ -338,36 +421,44 @@ proxy_t::~proxy_t()
 
 void proxy_t::proxy_release()
 {
-  if(data)
+  if(data && data->counter.release())
+    destroy(proxy, data, type);
+
+  proxy = nullptr;
+  data = nullptr;
+}
+
+void proxy_t::destroy(wl_proxy *proxy, proxy_data_t *data, wrapper_type type)
+{
+  if(proxy)
   {
-    if(--data->counter == 0)
+    switch(type)
     {
-      if(proxy)
-      {
-        switch(type)
-        {
-        case wrapper_type::standard:
-          if(data->has_destroy_opcode)
-            wl_proxy_marshal(proxy, data->destroy_opcode);
-          wl_proxy_destroy(proxy);
-          break;
-        case wrapper_type::proxy_wrapper:
-          wl_proxy_wrapper_destroy(proxy);
-          break;
-        case wrapper_type::display:
-          wl_display_disconnect(reinterpret_cast<wl_display*> (proxy));
-          break;
-        default:
-          throw std::logic_error("Invalid proxy_t type on destruction");
-        }
-      }
-
-      delete data;
+    case wrapper_type::standard:
+#if WAYLAND_VERSION_MAJOR > 1 || WAYLAND_VERSION_MINOR > 19
+      // Send the destructor and destroy the proxy under a single lock of the display
+      if(data->has_destroy_opcode)
+        wl_proxy_marshal_flags(proxy, data->destroy_opcode, nullptr, wl_proxy_get_version(proxy), WL_MARSHAL_FLAG_DESTROY);
+      else
+        wl_proxy_destroy(proxy);
+#else
+      if(data->has_destroy_opcode)
+        wl_proxy_marshal(proxy, data->destroy_opcode);
+      wl_proxy_destroy(proxy);
+#endif
+      break;
+    case wrapper_type::proxy_wrapper:
+      wl_proxy_wrapper_destroy(proxy);
+      break;
+    case wrapper_type::display:
+      wl_display_disconnect(reinterpret_cast<wl_display*> (proxy));
+      break;
+    default:
+      throw std::logic_error("Invalid proxy_t type on destruction");
     }
   }
 
-  proxy = nullptr;
-  data = nullptr;
+  delete data;
 }
 
 
@@ -494,9 +585,19 @@ display_t::display_t(display_t &&d) noexcept
 display_t &display_t::operator=(display_t &&d) noexcept
 {
   proxy_t::operator=(std::move(d));
+  std::swap(pump_prepared, d.pump_prepared);
+  std::swap(pump_flush_blocked, d.pump_flush_blocked);
+  std::swap(globals_state, d.globals_state);
   return *this;
 }
 
+display_t::~display_t() noexcept
+{
+  // don't let other readers wait for a read that never happens
+  if(pump_prepared && proxy_has_object())
+    wl_display_cancel_read(*this);
+}
+
 event_queue_t display_t::create_queue() const
 {
   wl_event_queue *queue = wl_display_create_queue(*this);
@@ -554,6 +655,88 @@ int display_t::dispatch_queue_pending(const event_queue_t& queue) const
   return check_return_value(wl_display_dispatch_queue_pending(*this, queue), "wl_display_dispatch_queue_pending");
 }
 
+display_t::pump_result_t display_t::pump(bool readable, bool writable, const std::vector<event_queue_t> &queues)
+{
+  pump_result_t result;
+
+  if(pump_prepared)
+  {
+    pump_prepared = false;
+    if(readable)
+      check_return_value(wl_display_read_events(*this), "wl_display_read_events");
+    else
+      wl_display_cancel_read(*this);
+  }
+
+  auto dispatch_all = [&] ()
+  {
+    result.dispatched += dispatch_pending();
+    for(auto const &queue : queues)
+      result.dispatched += dispatch_queue_pending(queue);
+  };
+  dispatch_all();
+
+  // Events may have been queued by other threads in the meantime.
+  while(true)
+  {
+    if(wl_display_prepare_read(*this) != 0)
+    {
+      if(errno != EAGAIN)
+        throw std::system_error(errno, std::generic_category(), "wl_display_prepare_read");
+      dispatch_all();
+      continue;
+    }
+
+    // While the intent is held, nobody reads, so the other queues can be
+    // checked one after another. Checking adds an intent of its own, which
+    // is cancelled again right away.
+    bool empty = true;
+    for(auto const &queue : queues)
+    {
+      if(wl_display_prepare_read_queue(*this, queue) == 0)
+        wl_display_cancel_read(*this);
+      else
+      {
+        int error = errno;
+        wl_display_cancel_read(*this);
+        if(error != EAGAIN)
+          throw std::system_error(error, std::generic_category(), "wl_display_prepare_read_queue");
+        empty = false;
+        break;
+      }
+    }
+    if(empty)
+      break;
+    dispatch_all();
+  }
+  pump_prepared = true;
+
+  if(!pump_flush_blocked || writable)
+  {
+    int bytes_written = wl_display_flush(*this);
+    pump_flush_blocked = bytes_written < 0 && errno == EAGAIN;
+    if(bytes_written < 0 && !pump_flush_blocked)
+    {
+      int error = errno;
+      wl_display_cancel_read(*this);
+      pump_prepared = false;
+      throw std::system_error(error, std::generic_category(), "wl_display_flush");
+    }
+  }
+  result.want_write = pump_flush_blocked;
+
+  return result;
+}
+
+void display_t::pump_release()
+{
+  if(pump_prepared)
+  {
+    wl_display_cancel_read(*this);
+    pump_prepared = false;
+  }
+}
+
 int display_t::dispatch() const
 {
   return check_return_value(wl_display_dispatch(*this), "wl_display_dispatch");
@@ -605,3 +788,274 @@ display_t display_t::proxy_create_wrapper()
 {
   return display_t{*this, construct_proxy_wrapper_tag()};
 }
+
+struct queue_dispatcher_t::data_t
+{
+  struct worker_t
+  {
+    std::vector<event_queue_t> queues;
+    // incremented whenever queues changes
+    unsigned int version = 0;
+    std::thread thread;
+  };
+
+  display_t &display;
+  // never has any proxies, only used to announce the intent to read
+  event_queue_t reader_queue;
+  int wakeup_fd = -1;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  // incremented after every read from the display
+  unsigned long generation = 0;
+  bool stopping = false;
+  std::exception_ptr error;
+  std::vector<worker_t> workers;
+  std::thread reader;
+
+  data_t(display_t &d)
+    : display(d), reader_queue(d.create_queue())
+  {
+  }
+
+  // Record the first error and stop all threads
+  void fail(std::exception_ptr e)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(!error)
+        error = std::move(e);
+      stopping = true;
+    }
+    cond.notify_all();
+    wake_reader();
+  }
+
+  // Must not be called with the mutex locked. A failure is recorded like
+  // any other error, so stop() rethrows it.
+  void wake_reader()
+  {
+    std::uint64_t one = 1;
+    if(write(wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+      auto e = std::make_exception_ptr(std::system_error(errno, std::generic_category(), "Failed to wake up the reader thread"));
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!error)
+          error = e;
+        stopping = true;
+      }
+      cond.notify_all();
+    }
+  }
+
+  bool should_stop()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stopping;
+  }
+
+  void read_loop()
+  {
+    wl_display *c_display = display;
+    try
+    {
+      while(!should_stop())
+      {
+        auto intent = display.obtain_queue_read_intent(reader_queue);
+
+        bool flushed = true;
+        if(wl_display_flush(c_display) < 0)
+        {
+          if(errno != EAGAIN && errno != EPIPE)
+            throw std::system_error(errno, std::generic_category(), "wl_display_flush");
+          // On EPIPE, the read below reports the error.
+          flushed = errno != EAGAIN;
+        }
+
+        std::array<pollfd, 2> fds = {{
+            {wl_display_get_fd(c_display), static_cast<short>(POLLIN | (flushed ? 0 : POLLOUT)), 0},
+            {wakeup_fd, POLLIN, 0}
+          }};
+        if(poll(fds.data(), fds.size(), -1) < 0)
+        {
+          if(errno == EINTR)
+            continue;
+          throw std::system_error(errno, std::generic_category(), "poll");
+        }
+
+        if(fds[1].revents & POLLIN)
+        {
+          std::uint64_t count;
+          if(::read(wakeup_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+
+        if(fds[0].revents & (POLLIN | POLLERR | POLLHUP))
+        {
+          intent.read();
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation++;
+          }
+          cond.notify_all();
+        }
+      }
+    }
+    catch(...)
+    {
+      fail(std::current_exception());
+    }
+  }
+
+  void dispatch_loop(unsigned int index)
+  {
+    wl_display *c_display = display;
+    std::vector<event_queue_t> queues;
+    unsigned int version = 0;
+    unsigned long seen = 0;
+    try
+    {
+      while(true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cond.wait(lock, [&] { return stopping || generation != seen || workers[index].version != version; });
+          if(stopping)
+            return;
+          seen = generation;
+          if(workers[index].version != version)
+          {
+            queues = workers[index].queues;
+            version = workers[index].version;
+          }
+        }
+
+        for(auto &queue : queues)
+          check_return_value(wl_display_dispatch_queue_pending(c_display, queue), "wl_display_dispatch_queue_pending");
+
+        // Send the requests of the event handlers, or let the reader wait
+        // until the socket becomes writable.
+        if(wl_display_flush(c_display) < 0 && errno == EAGAIN)
+          wake_reader();
+      }
+    }
+    catch(...)
+    {
+      fail(std::current_exception());
+    }
+  }
+};
+
+queue_dispatcher_t::queue_dispatcher_t(display_t &display, unsigned int threads)
+  : data(new data_t(display))
+{
+  if(threads == 0)
+    throw std::invalid_argument("A queue dispatcher needs at least one thread.");
+
+  data->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if(data->wakeup_fd < 0)
+    throw std::system_error(errno, std::generic_category(), "eventfd");
+
+  // The workers must exist before any thread looks at them.
+  data->workers.resize(threads);
+  try
+  {
+    for(unsigned int c = 0; c < threads; c++)
+      data->workers[c].thread = std::thread(&data_t::dispatch_loop, data.get(), c);
+    data->reader = std::thread(&data_t::read_loop, data.get());
+  }
+  catch(...)
+  {
+    try
+    {
+      stop();
+    }
+    catch(...)
+    {
+    }
+    close(data->wakeup_fd);
+    throw;
+  }
+}
+
+queue_dispatcher_t::~queue_dispatcher_t() noexcept
+{
+  try
+  {
+    stop();
+  }
+  catch(...)
+  {
+  }
+  close(data->wakeup_fd);
+}
+
+unsigned int queue_dispatcher_t::threads() const
+{
+  return static_cast<unsigned int>(data->workers.size());
+}
+
+unsigned int queue_dispatcher_t::add_queue(const event_queue_t &queue)
+{
+  unsigned int worker = 0;
+  {
+    std::lock_guard<std::mutex> lock(data->mutex);
+    for(unsigned int c = 1; c < data->workers.size(); c++)
+      if(data->workers[c].queues.size() < data->workers[worker].queues.size())
+        worker = c;
+    data->workers[worker].queues.push_back(queue);
+    data->workers[worker].version++;
+  }
+  data->cond.notify_all();
+  return worker;
+}
+
+void queue_dispatcher_t::add_queue(const event_queue_t &queue, unsigned int worker)
+{
+  {
+    std::lock_guard<std::mutex> lock(data->mutex);
+    data->workers.at(worker).queues.push_back(queue);
+    data->workers[worker].version++;
+  }
+  data->cond.notify_all();
+}
+
+void queue_dispatcher_t::remove_queue(const event_queue_t &queue)
+{
+  {
+    std::lock_guard<std::mutex> lock(data->mutex);
+    for(auto &worker : data->workers)
+    {
+      auto it = std::find_if(worker.queues.begin(), worker.queues.end(), [&] (const event_queue_t &q)
+                             { return q.c_ptr() == queue.c_ptr(); });
+      if(it != worker.queues.end())
+      {
+        worker.queues.erase(it);
+        worker.version++;
+      }
+    }
+  }
+  data->cond.notify_all();
+}
+
+void queue_dispatcher_t::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(data->mutex);
+    data->stopping = true;
+  }
+  data->cond.notify_all();
+  data->wake_reader();
+
+  if(data->reader.joinable())
+    data->reader.join();
+  for(auto &worker : data->workers)
+    if(worker.thread.joinable())
+      worker.thread.join();
+
+  std::exception_ptr error;
+  std::swap(error, data->error);
+  if(error)
+    std::rethrow_exception(error);
+}
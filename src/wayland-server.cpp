@@ -23,9 +23,30 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
 #include <stdexcept>
-#include <iostream>
+#include <iterator>
 #include <limits>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#ifdef WAYLANDPP_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 #include <wayland-server-core.h>
 #include <wayland-server.hpp>
 
@@ -38,6 +59,20 @@ namespace
 
   log_handler g_log_handler;
 
+  // Bytes in the send queue of a socket
+  bool output_queue_size(int fd, std::size_t &size)
+  {
+    int queued = 0;
+#ifdef TIOCOUTQ
+    if(ioctl(fd, TIOCOUTQ, &queued) < 0)
+#else
+    if(ioctl(fd, FIONWRITE, &queued) < 0)
+#endif
+      return false;
+    size = static_cast<std::size_t>(queued);
+    return true;
+  }
+
   extern "C"
   void _c_log_handler(const char *format, va_list args)
   {
@@ -78,6 +113,95 @@ void wayland::server::set_log_handler(const log_handler& handler)
 
 //-----------------------------------------------------------------------------
 
+struct wayland::server::detail::backpressure_data_t
+{
+  wl_display *display = nullptr;
+  std::size_t high_water = 0;
+  std::size_t low_water = 0;
+  std::function<backpressure_action_t(client_t&, std::size_t)> high_water_func;
+  std::function<void(client_t&, std::size_t)> low_water_func;
+  // interface and event names
+  std::vector<std::pair<std::string, std::string>> droppable_events;
+  // droppable opcodes, resolved from the names on first use
+  std::unordered_map<const wl_interface*, uint64_t> droppable_masks;
+
+  bool droppable(const wl_interface *interface, uint32_t opcode)
+  {
+    auto it = droppable_masks.find(interface);
+    if(it == droppable_masks.end())
+    {
+      uint64_t mask = 0;
+      for(const auto &event : droppable_events)
+        if(event.first == interface->name)
+          for(int c = 0; c < interface->event_count && c < 64; c++)
+            if(event.second == interface->events[c].name)
+              mask |= uint64_t(1) << c;
+      it = droppable_masks.emplace(interface, mask).first;
+    }
+    return opcode < 64 && (it->second >> opcode & 1);
+  }
+};
+
+struct wayland::server::detail::coalesce_data_t
+{
+  struct link_t
+  {
+    wl_list link;
+    coalesce_data_t *coalesce;
+  };
+
+  struct event_t
+  {
+    uint32_t opcode;
+    std::vector<wl_argument> args;
+  };
+
+  wl_resource *resource = nullptr;
+  // argument types of the events, by opcode
+  std::vector<std::string> types;
+  // opcodes of coalesced events, by mode
+  uint64_t latest = 0;
+  uint64_t accumulate = 0;
+  int frame = -1;
+
+  // in the coalesced list of the display while events are held back
+  link_t link = { { nullptr, nullptr }, this };
+  bool linked = false;
+  bool post = false;
+  std::vector<event_t> events;
+  event_t frame_event = { 0, {} };
+  bool frame_pending = false;
+
+  void unlink()
+  {
+    if(linked)
+      wl_list_remove(&link.link);
+    linked = false;
+  }
+
+  void send()
+  {
+    unlink();
+    for(auto &event : events)
+      if(post)
+        wl_resource_post_event_array(resource, event.opcode, event.args.data());
+      else
+        wl_resource_queue_event_array(resource, event.opcode, event.args.data());
+    if(frame_pending)
+    {
+      if(post)
+        wl_resource_post_event_array(resource, frame_event.opcode, frame_event.args.data());
+      else
+        wl_resource_queue_event_array(resource, frame_event.opcode, frame_event.args.data());
+    }
+    events.clear();
+    frame_pending = false;
+    post = false;
+  }
+};
+
+//-----------------------------------------------------------------------------
+
 display_t::data_t *display_t::wl_display_get_user_data(wl_display *display)
 {
   wl_listener *listener = wl_display_get_destroy_listener(display, destroy_func);
@@ -109,6 +233,7 @@ void display_t::init()
   data->client_created_listener.user = data;
   data->destroy_listener.listener.notify = destroy_func;
   data->client_created_listener.listener.notify = client_created_func;
+  wl_list_init(&data->coalesced);
   wl_display_add_destroy_listener(display, reinterpret_cast<wl_listener*>(&data->destroy_listener));
   wl_display_add_client_created_listener(display, reinterpret_cast<wl_listener*>(&data->client_created_listener));
 }
@@ -226,6 +351,7 @@ void display_t::run() const
 
 void display_t::flush_clients() const
 {
+  resource_t::flush_coalesced(data, nullptr);
   wl_display_flush_clients(c_ptr());
 }
 
@@ -292,6 +418,11 @@ client_t::data_t *client_t::wl_client_get_user_data(wl_client *client)
 void client_t::destroy_func(wl_listener *listener, void */*unused*/)
 {
   auto *data = reinterpret_cast<data_t*>(reinterpret_cast<listener_t*>(listener)->user);
+  if(data->backpressure)
+  {
+    data->backpressure.reset();
+    data->drop_events = false;
+  }
   if(data->destroy)
     data->destroy();
 }
@@ -410,6 +541,9 @@ wayland::detail::any &client_t::user_data()
 
 void client_t::flush() const
 {
+  display_t::data_t *display = display_t::wl_display_get_user_data(wl_client_get_display(c_ptr()));
+  if(display)
+    resource_t::flush_coalesced(display, c_ptr());
   wl_client_flush(c_ptr());
 }
 
@@ -423,6 +557,19 @@ int client_t::get_fd() const
   return wl_client_get_fd(c_ptr());
 }
 
+std::size_t client_t::get_output_queue_size() const
+{
+  std::size_t size = 0;
+  if(!output_queue_size(get_fd(), size))
+    throw std::system_error(errno, std::generic_category(), "ioctl");
+  return size;
+}
+
+bool client_t::is_congested() const
+{
+  return static_cast<bool>(data->backpressure);
+}
+
 std::function<void()> &client_t::on_destroy()
 {
   return data->destroy;
@@ -488,13 +635,25 @@ std::function<void(resource_t&)> &client_t::on_resource_created()
 void resource_t::destroy_func(wl_listener *listener, void */*unused*/)
 {
   auto *data = reinterpret_cast<resource_t::data_t*>(reinterpret_cast<listener_t*>(listener)->user);
+  if(data->alive)
+    *data->alive = false;
+  // held back events are dropped along with the resource
+  if(data->coalesce)
+    data->coalesce->unlink();
   if(data->destroy)
     data->destroy();
   reinterpret_cast<listener_t*>(listener)->user = nullptr;
   delete data;
 }
 
-int resource_t::dummy_dispatcher(int /*opcode*/, const std::vector<wayland::detail::any>& /*args*/, const std::shared_ptr<resource_t::events_base_t>& /*events*/)
+std::shared_ptr<bool> resource_t::alive_token() const
+{
+  if(!data->alive)
+    data->alive = std::make_shared<bool>(true);
+  return data->alive;
+}
+
+int resource_t::dummy_dispatcher(uint32_t /*opcode*/, wl_resource* /*target*/, const wl_argument* /*args*/, const std::shared_ptr<resource_t::events_base_t>& /*events*/)
 {
   return 0;
 }
@@ -503,17 +662,19 @@ void resource_t::init()
 {
   data = new data_t;
   data->counter = 1;
+  data->client = client_t(wl_resource_get_client(resource)).data;
   data->destroy_listener.user = data;
   data->destroy_listener.listener.notify = destroy_func;
   wl_resource_set_user_data(resource, data);
   wl_resource_add_destroy_listener(resource, reinterpret_cast<wl_listener*>(&data->destroy_listener));
-  wl_resource_set_dispatcher(resource, c_dispatcher, reinterpret_cast<void*>(dummy_dispatcher), data, nullptr); // dummy dispatcher
+  wl_resource_set_dispatcher(resource, c_typed_dispatcher, reinterpret_cast<void*>(dummy_dispatcher), data, nullptr); // dummy dispatcher
 }
 
 resource_t::resource_t(const client_t& client, const wl_interface *interface, int version, uint32_t id)
 {
   resource = wl_resource_create(client.c_ptr(), interface, version, id);
   init();
+  data->interface = interface;
 }
 
 resource_t::resource_t(wl_resource *c)
@@ -608,16 +769,13 @@ int resource_t::c_dispatcher(const void *implementation, void *target, uint32_t
   resource_t p(reinterpret_cast<wl_resource*>(target));
   client_t cl = p.get_client();
 
-  std::string signature(message->signature);
+  const message_signature_t &signature = message_signature(message);
   std::vector<any> vargs;
-  unsigned int c = 0;
-  for(char ch : signature)
+  vargs.reserve(signature.arity());
+  for(unsigned int c = 0; c < signature.arity(); c++)
   {
-    if(ch == '?' || isdigit(ch))
-      continue;
-
     any a;
-    switch(ch)
+    switch(signature.arguments[c].type)
     {
       // int_32_t
     case 'i':
@@ -669,8 +827,7 @@ int resource_t::c_dispatcher(const void *implementation, void *target, uint32_t
       a = 0;
       break;
     }
-    vargs.push_back(a);
-    c++;
+    vargs.push_back(std::move(a));
   }
 
   using dispatcher_func = int(*)(int, std::vector<any>, std::shared_ptr<resource_t::events_base_t>);
@@ -678,6 +835,50 @@ int resource_t::c_dispatcher(const void *implementation, void *target, uint32_t
   return dispatcher(opcode, vargs, p.get_events());
 }
 
+int resource_t::c_typed_dispatcher(const void *implementation, void *target, uint32_t opcode, const wl_message *message, wl_argument *args)
+{
+  if(!implementation)
+    throw std::invalid_argument("resource dispatcher: implementation is NULL.");
+  if(!target)
+    throw std::invalid_argument("resource dispatcher: target is NULL.");
+  if(!message)
+    throw std::invalid_argument("resource dispatcher: message is NULL.");
+
+  auto *resource = reinterpret_cast<wl_resource*>(target);
+  auto *data = static_cast<data_t*>(wl_resource_get_user_data(resource));
+  if(!data)
+    return 0;
+
+  // The handler may destroy the resource, so the event storage has to
+  // outlive the call.
+  std::shared_ptr<events_base_t> events = data->events;
+  using dispatcher_func = int(*)(uint32_t, wl_resource*, const wl_argument*, const std::shared_ptr<resource_t::events_base_t>&);
+  auto dispatcher = reinterpret_cast<dispatcher_func>(const_cast<void*>(implementation));
+  return dispatcher(opcode, resource, args, events);
+}
+
+resource_t resource_t::object_argument(wl_object *o)
+{
+  if(o)
+    return resource_t(reinterpret_cast<wl_resource*>(o));
+  return resource_t();
+}
+
+resource_t resource_t::new_id_argument(wl_resource *parent, const wl_interface *interface, uint32_t id)
+{
+  if(!id)
+    return resource_t();
+  // New objects inherit the version of the object they were created from.
+  return resource_t(client_t(wl_resource_get_client(parent)), interface, wl_resource_get_version(parent), id);
+}
+
+wayland::array_t resource_t::array_argument(wl_array *a)
+{
+  if(a)
+    return array_t(a);
+  return array_t();
+}
+
 void resource_t::set_events(const std::shared_ptr<events_base_t>& events,
                             int(*dispatcher)(int, const std::vector<any>&, const std::shared_ptr<resource_t::events_base_t>&))
 {
@@ -690,27 +891,77 @@ void resource_t::set_events(const std::shared_ptr<events_base_t>& events,
   }
 }
 
+void resource_t::set_events(const std::shared_ptr<events_base_t>& events,
+                            int(*dispatcher)(uint32_t, wl_resource*, const wl_argument*, const std::shared_ptr<resource_t::events_base_t>&))
+{
+  // set only one time
+  if(!data->events)
+  {
+    data->events = events;
+    // the dispatcher gets 'implemetation'
+    wl_resource_set_dispatcher(c_ptr(), c_typed_dispatcher, reinterpret_cast<void*>(dispatcher), data, nullptr);
+  }
+}
+
 std::shared_ptr<resource_t::events_base_t> resource_t::get_events() const
 {
   return data->events;
 }
 
+bool resource_t::has_events() const
+{
+  return data && data->events;
+}
+
+namespace
+{
+  // libwayland does not support messages with more arguments (WL_CLOSURE_MAX_ARGS)
+  constexpr std::size_t max_event_arguments = 20;
+
+  std::array<wl_argument, max_event_arguments> to_wl_arguments(const std::vector<argument_t>& v)
+  {
+    if(v.size() > max_event_arguments)
+      throw std::invalid_argument("Too many event arguments.");
+    std::array<wl_argument, max_event_arguments> args;
+    for(unsigned int c = 0; c < v.size(); c++)
+      args[c] = v[c].get_c_argument();
+    return args;
+  }
+}
+
 void resource_t::post_event_array(uint32_t opcode, const std::vector<argument_t>& v) const
 {
-  auto *args = new wl_argument[v.size()];
-  for(unsigned int c = 0; c < v.size(); c++)
-    args[c] = v[c].get_c_argument();
-  wl_resource_post_event_array(c_ptr(), opcode, args);
-  delete[] args;
+  auto args = to_wl_arguments(v);
+  post_event_array(opcode, args.data());
 }
 
 void resource_t::queue_event_array(uint32_t opcode, const std::vector<argument_t>& v) const
 {
-  auto *args = new wl_argument[v.size()];
-  for(unsigned int c = 0; c < v.size(); c++)
-    args[c] = v[c].get_c_argument();
+  auto args = to_wl_arguments(v);
+  queue_event_array(opcode, args.data());
+}
+
+void resource_t::post_event_array(uint32_t opcode, wl_argument *args) const
+{
+  if(data && data->client->drop_events && dropped(opcode))
+    return;
+  if(data && data->coalesce && coalesced(opcode, args, true))
+    return;
+  wl_resource_post_event_array(c_ptr(), opcode, args);
+}
+
+void resource_t::queue_event_array(uint32_t opcode, wl_argument *args) const
+{
+  if(data && data->client->drop_events && dropped(opcode))
+    return;
+  if(data && data->coalesce && coalesced(opcode, args, false))
+    return;
   wl_resource_queue_event_array(c_ptr(), opcode, args);
-  delete[] args;
+}
+
+bool resource_t::dropped(uint32_t opcode) const
+{
+  return data->interface && data->client->backpressure->droppable(data->interface, opcode);
 }
 
 void resource_t::post_error(uint32_t code, const std::string& msg) const
@@ -748,6 +999,148 @@ std::function<void()> &resource_t::on_destroy()
   return data->destroy;
 }
 
+coalesce_data_t &resource_t::coalesce_data()
+{
+  wl_resource *res = c_ptr();
+  if(!data->interface)
+    throw std::runtime_error("Events can only be coalesced for resources created by this library.");
+  if(!data->coalesce)
+  {
+    data->coalesce.reset(new coalesce_data_t);
+    data->coalesce->resource = res;
+    // signatures may contain a version and nullable markers
+    for(int c = 0; c < data->interface->event_count; c++)
+    {
+      std::string types;
+      for(const char *t = data->interface->events[c].signature; *t; t++)
+        if(std::isalpha(static_cast<unsigned char>(*t)))
+          types += *t;
+      data->coalesce->types.push_back(types);
+    }
+  }
+  return *data->coalesce;
+}
+
+uint32_t resource_t::coalesce_opcode(const std::string &event_name)
+{
+  const coalesce_data_t &coalesce = coalesce_data();
+  for(int c = 0; c < data->interface->event_count; c++)
+    if(event_name == data->interface->events[c].name)
+    {
+      if(c >= 64 || coalesce.types[c].find_first_not_of("iuf") != std::string::npos)
+        throw std::invalid_argument("Event " + event_name + " cannot be coalesced.");
+      return static_cast<uint32_t>(c);
+    }
+  throw std::invalid_argument("Interface " + std::string(data->interface->name) + " has no event " + event_name + ".");
+}
+
+void resource_t::coalesce_event(const std::string &event_name, coalesce_mode_t mode)
+{
+  uint32_t opcode = coalesce_opcode(event_name);
+  coalesce_data_t &coalesce = *data->coalesce;
+  uint64_t bit = uint64_t(1) << opcode;
+  coalesce.latest &= ~bit;
+  coalesce.accumulate &= ~bit;
+  if(mode == coalesce_mode_t::accumulate)
+    coalesce.accumulate |= bit;
+  else
+    coalesce.latest |= bit;
+}
+
+void resource_t::set_coalesce_frame(const std::string &event_name)
+{
+  uint32_t opcode = coalesce_opcode(event_name);
+  data->coalesce->frame = static_cast<int>(opcode);
+}
+
+bool resource_t::coalesced(uint32_t opcode, wl_argument *args, bool post) const
+{
+  coalesce_data_t &coalesce = *data->coalesce;
+  uint64_t bit = opcode < 64 ? uint64_t(1) << opcode : 0;
+
+  if((coalesce.latest | coalesce.accumulate) & bit)
+  {
+    const std::string &types = coalesce.types[opcode];
+    auto event = std::find_if(coalesce.events.begin(), coalesce.events.end(),
+                              [opcode] (const coalesce_data_t::event_t &e) { return e.opcode == opcode; });
+
+    // Send the held back events instead of letting a sum overflow.
+    if(event != coalesce.events.end() && (coalesce.accumulate & bit))
+      for(std::string::size_type c = 0; c < types.size(); c++)
+        if(types[c] == 'f')
+        {
+          int64_t sum = int64_t(event->args[c].f) + args[c].f;
+          if(sum > std::numeric_limits<int32_t>::max() || sum < std::numeric_limits<int32_t>::min())
+          {
+            coalesce.send();
+            event = coalesce.events.end();
+            break;
+          }
+        }
+
+    if(!coalesce.linked)
+    {
+      wl_display *d = wl_client_get_display(wl_resource_get_client(c_ptr()));
+      display_t::data_t *display = display_t::wl_display_get_user_data(d);
+      if(!display)
+        return false;
+      wl_list_insert(display->coalesced.prev, &coalesce.link.link);
+      coalesce.linked = true;
+      if(!display->coalesce_idle)
+        display->coalesce_idle = wl_event_loop_add_idle(wl_display_get_event_loop(d), coalesce_idle_func, display);
+    }
+
+    if(event == coalesce.events.end())
+      coalesce.events.push_back({ opcode, std::vector<wl_argument>(args, args + types.size()) });
+    else if(coalesce.accumulate & bit)
+    {
+      for(std::string::size_type c = 0; c < types.size(); c++)
+        if(types[c] == 'f')
+          event->args[c].f += args[c].f;
+        else
+          event->args[c] = args[c];
+    }
+    else
+      std::copy(args, args + types.size(), event->args.begin());
+    coalesce.post = coalesce.post || post;
+    return true;
+  }
+
+  if(static_cast<int>(opcode) == coalesce.frame && !coalesce.events.empty())
+  {
+    coalesce.frame_event.opcode = opcode;
+    coalesce.frame_event.args.assign(args, args + coalesce.types[opcode].size());
+    coalesce.frame_pending = true;
+    coalesce.post = coalesce.post || post;
+    return true;
+  }
+
+  // Keep the order with respect to all other events.
+  if(coalesce.linked)
+    coalesce.send();
+  return false;
+}
+
+void resource_t::coalesce_idle_func(void *data)
+{
+  auto *display = static_cast<display_t::data_t*>(data);
+  display->coalesce_idle = nullptr;
+  flush_coalesced(display, nullptr);
+}
+
+void resource_t::flush_coalesced(display_t::data_t *display, wl_client *client)
+{
+  wl_list *link = display->coalesced.next;
+  while(link != &display->coalesced)
+  {
+    wl_list *next = link->next;
+    coalesce_data_t *coalesce = reinterpret_cast<coalesce_data_t::link_t*>(link)->coalesce;
+    if(!client || wl_resource_get_client(coalesce->resource) == client)
+      coalesce->send();
+    link = next;
+  }
+}
+
 //-----------------------------------------------------------------------------
 
 bool global_base_t::has_interface(const wl_interface *interface) const
@@ -887,42 +1280,143 @@ event_loop_t::data_t *event_loop_t::wl_event_loop_get_user_data(wl_event_loop *c
   return nullptr;
 }
 
+struct event_loop_t::source_data_t : public wayland::detail::pooled_t
+{
+  // entry in the list of the event loop, like listener_t
+  struct link_t
+  {
+    wl_list link;
+    source_data_t *source;
+  };
+
+  link_t link = { { nullptr, nullptr }, this };
+  wl_event_source *source = nullptr;
+  // wl_event_source_remove() was called, or the event loop is gone
+  bool removed = false;
+  // the dispatch function is running and must not be freed yet
+  bool dispatching = false;
+  // the last event_source_t is gone
+  bool released = false;
+
+  virtual ~source_data_t() = default;
+
+  // Free the source after the dispatch function returned, if it was
+  // released in the meantime.
+  class dispatch_guard_t
+  {
+  private:
+    source_data_t *source;
+
+  public:
+    dispatch_guard_t(source_data_t *s)
+      : source(s)
+    {
+      source->dispatching = true;
+    }
+
+    dispatch_guard_t(const dispatch_guard_t&) = delete;
+    dispatch_guard_t &operator=(const dispatch_guard_t&) = delete;
+
+    ~dispatch_guard_t()
+    {
+      source->dispatching = false;
+      if(source->released)
+        delete source;
+    }
+  };
+};
+
+template <typename F>
+struct event_loop_t::source_func_t : public event_loop_t::source_data_t
+{
+  F func;
+
+  source_func_t(F f)
+    : func(std::move(f))
+  {
+  }
+};
+
 void event_loop_t::destroy_func(wl_listener *listener, void */*unused*/)
 {
   auto *data = reinterpret_cast<event_loop_t::data_t*>(reinterpret_cast<listener_t*>(listener)->user);
   if(data->destroy)
     data->destroy();
+  // libwayland frees the remaining sources with the loop
+  while(!wl_list_empty(&data->sources))
+  {
+    source_data_t *source = reinterpret_cast<source_data_t::link_t*>(data->sources.next)->source;
+    wl_list_remove(&source->link.link);
+    source->removed = true;
+  }
   delete data;
 }
 
+void event_loop_t::release_source(source_data_t *source)
+{
+  if(!source->removed)
+  {
+    wl_event_source_remove(source->source);
+    wl_list_remove(&source->link.link);
+    source->removed = true;
+  }
+  if(source->dispatching)
+    source->released = true;
+  else
+    delete source;
+}
+
+event_source_t event_loop_t::make_source(source_data_t *source, wl_event_source *p)
+{
+  if(!p)
+  {
+    delete source;
+    throw std::runtime_error("Failed to add event source.");
+  }
+  source->source = p;
+  wl_list_insert(&data->sources, &source->link.link);
+  return std::shared_ptr<wl_event_source>(p, [source] (wl_event_source */*unused*/) { release_source(source); },
+                                          pool_allocator_t<wl_event_source>());
+}
+
 int event_loop_t::event_loop_fd_func(int fd, uint32_t mask, void *data)
 {
-  auto *f = reinterpret_cast<std::function<int(int, uint32_t)>*>(data);
-  return (*f)(fd, mask);
+  auto *source = static_cast<source_func_t<std::function<int(int, uint32_t)>>*>(data);
+  source_data_t::dispatch_guard_t guard(source);
+  return source->func(fd, mask);
 }
 
 int event_loop_t::event_loop_timer_func(void *data)
 {
-  auto *f = reinterpret_cast<std::function<int()>*>(data);
-  return (*f)();
+  auto *source = static_cast<source_func_t<std::function<int()>>*>(data);
+  source_data_t::dispatch_guard_t guard(source);
+  return source->func();
 }
 
 int event_loop_t::event_loop_signal_func(int signal_number, void *data)
 {
-  auto *f = reinterpret_cast<std::function<int(int)>*>(data);
-  return (*f)(signal_number);
+  auto *source = static_cast<source_func_t<std::function<int(int)>>*>(data);
+  source_data_t::dispatch_guard_t guard(source);
+  return source->func(signal_number);
 }
 
 void event_loop_t::event_loop_idle_func(void *data)
 {
-  auto *f = reinterpret_cast<std::function<void()>*>(data);
-  (*f)();
+  auto *source = static_cast<source_func_t<std::function<void()>>*>(data);
+  // libwayland removes idle sources right after dispatching them. The
+  // function is moved out first, so the source may be released meanwhile.
+  wl_list_remove(&source->link.link);
+  source->removed = true;
+  auto func = std::move(source->func);
+  source->func = nullptr;
+  func();
 }
 
 void event_loop_t::init()
 {
   data = new data_t;
   data->counter = 1;
+  wl_list_init(&data->sources);
   data->destroy_listener.user = data;
   data->destroy_listener.listener.notify = destroy_func;
   wl_event_loop_add_destroy_listener(event_loop, reinterpret_cast<wl_listener*>(&data->destroy_listener));
@@ -1012,26 +1506,26 @@ wayland::detail::any &event_loop_t::user_data()
 
 event_source_t event_loop_t::add_fd(int fd, const fd_event_mask_t& mask, const std::function<int(int, uint32_t)> &func)
 {
-  data->fd_funcs.push_back(func);
-  return wl_event_loop_add_fd(event_loop, fd, mask, event_loop_t::event_loop_fd_func, &data->fd_funcs.back());
+  auto *source = new source_func_t<std::function<int(int, uint32_t)>>(func);
+  return make_source(source, wl_event_loop_add_fd(event_loop, fd, mask, event_loop_t::event_loop_fd_func, source));
 }
 
 event_source_t event_loop_t::add_timer(const std::function<int()> &func)
 {
-  data->timer_funcs.push_back(func);
-  return wl_event_loop_add_timer(event_loop, event_loop_t::event_loop_timer_func, &data->timer_funcs.back());
+  auto *source = new source_func_t<std::function<int()>>(func);
+  return make_source(source, wl_event_loop_add_timer(event_loop, event_loop_t::event_loop_timer_func, source));
 }
 
 event_source_t event_loop_t::add_signal(int signal_number, const std::function<int(int)> &func)
 {
-  data->signal_funcs.push_back(func);
-  return wl_event_loop_add_signal(event_loop, signal_number, event_loop_t::event_loop_signal_func, &data->signal_funcs.back());
+  auto *source = new source_func_t<std::function<int(int)>>(func);
+  return make_source(source, wl_event_loop_add_signal(event_loop, signal_number, event_loop_t::event_loop_signal_func, source));
 }
 
 event_source_t event_loop_t::add_idle(const std::function<void()> &func)
 {
-  data->idle_funcs.push_back(func);
-  return wl_event_loop_add_idle(event_loop, event_loop_t::event_loop_idle_func, &data->idle_funcs.back());
+  auto *source = new source_func_t<std::function<void()>>(func);
+  return make_source(source, wl_event_loop_add_idle(event_loop, event_loop_t::event_loop_idle_func, source));
 }
 
 const std::function<void()> &event_loop_t::on_destroy()
@@ -1056,16 +1550,9 @@ int event_loop_t::get_fd() const
 
 //-----------------------------------------------------------------------------
 
-event_source_t::event_source_t(wl_event_source *p)
-  : wayland::detail::refcounted_wrapper<wl_event_source>({p, wl_event_source_remove})
-{
-}
-
-wl_event_source *event_source_t::c_ptr() const
+event_source_t::event_source_t(std::shared_ptr<wl_event_source> p)
+  : wayland::detail::refcounted_wrapper<wl_event_source>(std::move(p))
 {
-  if(!event_source)
-    throw std::runtime_error("event_source is null.");
-  return event_source;
 }
 
 int event_source_t::timer_update(int ms_delay) const
@@ -1082,3 +1569,1111 @@ void event_source_t::check() const
 {
   wl_event_source_check(c_ptr());
 }
+
+//-----------------------------------------------------------------------------
+
+struct worker_pool_t::data_t
+{
+  struct task_t
+  {
+    std::function<void()> work;
+    std::function<void()> done;
+    std::exception_ptr error;
+  };
+
+  wl_event_source *source = nullptr;
+  // signalled whenever completed becomes non-empty
+  int completion_fd = -1;
+  std::function<void(std::exception_ptr)> error;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<task_t> pending;
+  std::deque<task_t> completed;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+
+  // Called from the worker threads, so failures can only be logged.
+  void signal() const
+  {
+    std::uint64_t one = 1;
+    if(write(completion_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+      int error = errno;
+      if(g_log_handler)
+        g_log_handler(std::string("Failed to wake up the event loop: ") + std::strerror(error) + "\n");
+    }
+  }
+
+  void work_loop()
+  {
+    while(true)
+    {
+      task_t task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return stopping || !pending.empty(); });
+        if(stopping)
+          return;
+        task = std::move(pending.front());
+        pending.pop_front();
+      }
+
+      try
+      {
+        task.work();
+      }
+      catch(...)
+      {
+        task.error = std::current_exception();
+      }
+      task.work = nullptr;
+
+      bool first = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        first = completed.empty();
+        completed.push_back(std::move(task));
+      }
+      if(first)
+        signal();
+    }
+  }
+
+  static int completion_func(int fd, uint32_t /*mask*/, void *user)
+  {
+    auto *d = static_cast<data_t*>(user);
+    std::uint64_t count;
+    if(read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+      throw std::system_error(errno, std::generic_category(), "read");
+
+    std::deque<task_t> tasks;
+    {
+      std::lock_guard<std::mutex> lock(d->mutex);
+      std::swap(tasks, d->completed);
+    }
+
+    try
+    {
+      while(!tasks.empty())
+      {
+        task_t task = std::move(tasks.front());
+        tasks.pop_front();
+        if(task.error)
+        {
+          if(!d->error)
+            std::rethrow_exception(task.error);
+          d->error(task.error);
+        }
+        else if(task.done)
+          task.done();
+      }
+    }
+    catch(...)
+    {
+      // Keep the rest for the next dispatch.
+      if(!tasks.empty())
+      {
+        {
+          std::lock_guard<std::mutex> lock(d->mutex);
+          std::move(d->completed.begin(), d->completed.end(), std::back_inserter(tasks));
+          std::swap(tasks, d->completed);
+        }
+        d->signal();
+      }
+      throw;
+    }
+    return 0;
+  }
+
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cond.notify_all();
+    for(auto &thread : threads)
+      if(thread.joinable())
+        thread.join();
+  }
+};
+
+worker_pool_t::worker_pool_t(const event_loop_t &event_loop, unsigned int threads)
+  : data(new data_t)
+{
+  if(threads == 0)
+    throw std::invalid_argument("A worker pool needs at least one thread.");
+
+  data->completion_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if(data->completion_fd < 0)
+    throw std::system_error(errno, std::generic_category(), "eventfd");
+  data->source = wl_event_loop_add_fd(event_loop.c_ptr(), data->completion_fd, WL_EVENT_READABLE,
+                                      data_t::completion_func, data.get());
+  if(!data->source)
+  {
+    close(data->completion_fd);
+    throw std::runtime_error("Failed to add the worker pool to the event loop.");
+  }
+
+  try
+  {
+    for(unsigned int c = 0; c < threads; c++)
+      data->threads.emplace_back(&data_t::work_loop, data.get());
+  }
+  catch(...)
+  {
+    data->stop();
+    wl_event_source_remove(data->source);
+    close(data->completion_fd);
+    throw;
+  }
+}
+
+worker_pool_t::~worker_pool_t() noexcept
+{
+  data->stop();
+  wl_event_source_remove(data->source);
+  close(data->completion_fd);
+}
+
+unsigned int worker_pool_t::threads() const
+{
+  return static_cast<unsigned int>(data->threads.size());
+}
+
+void worker_pool_t::post(const std::function<void()> &work, const std::function<void()> &done)
+{
+  if(!work)
+    throw std::invalid_argument("Work must not be empty.");
+  {
+    std::lock_guard<std::mutex> lock(data->mutex);
+    data->pending.push_back({work, done, nullptr});
+  }
+  data->cond.notify_one();
+}
+
+std::function<void(std::exception_ptr)> &worker_pool_t::on_error()
+{
+  return data->error;
+}
+
+//-----------------------------------------------------------------------------
+
+namespace
+{
+  // Every level has 2^wheel_bits slots. A slot of level n covers
+  // 2^(wheel_bits * n) milliseconds.
+  constexpr unsigned int wheel_bits = 6;
+  constexpr std::uint64_t wheel_slots = 1ULL << wheel_bits;
+  constexpr unsigned int wheel_levels = 4;
+  constexpr std::uint64_t wheel_range = 1ULL << (wheel_bits * wheel_levels);
+  constexpr std::uint64_t no_tick = std::numeric_limits<std::uint64_t>::max();
+
+  unsigned int lowest_bit(std::uint64_t bits)
+  {
+    return static_cast<unsigned int>(__builtin_ctzll(bits));
+  }
+}
+
+struct timer_wheel_t::data_t
+{
+  // Entry in a slot, like listener_t
+  struct link_t
+  {
+    link_t *prev;
+    link_t *next;
+    wheel_timer_t::data_t *timer;
+
+    link_t(wheel_timer_t::data_t *t = nullptr)
+      : prev(this), next(this), timer(t)
+    {
+    }
+
+    link_t(const link_t&) = delete;
+    link_t &operator=(const link_t&) = delete;
+
+    bool empty() const
+    {
+      return next == this;
+    }
+
+    void push_back(link_t *link)
+    {
+      link->prev = prev;
+      link->next = this;
+      prev->next = link;
+      prev = link;
+    }
+
+    void remove()
+    {
+      prev->next = next;
+      next->prev = prev;
+      prev = this;
+      next = this;
+    }
+
+    // Move all entries to an empty list
+    void move_to(link_t &list)
+    {
+      if(empty())
+        return;
+      list.next = next;
+      list.prev = prev;
+      next->prev = &list;
+      prev->next = &list;
+      prev = this;
+      next = this;
+    }
+  };
+
+  std::chrono::steady_clock::time_point epoch;
+  std::array<std::array<link_t, wheel_slots>, wheel_levels> slots;
+  // bit n is set if slot n of the level is not empty
+  std::array<std::uint64_t, wheel_levels> occupied{};
+  // the last processed millisecond since epoch
+  std::uint64_t current = 0;
+  // the millisecond the event source is armed for
+  std::uint64_t armed = no_tick;
+  std::size_t count = 0;
+  event_source_t source;
+
+  data_t(event_loop_t &event_loop)
+    : epoch(std::chrono::steady_clock::now()),
+      source(event_loop.add_timer([this] () { expire(); return 0; }))
+  {
+  }
+
+  ~data_t();
+
+  std::uint64_t now() const
+  {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - epoch).count());
+  }
+
+  void insert(wheel_timer_t::data_t *timer);
+  void remove(wheel_timer_t::data_t *timer);
+  std::uint64_t next_tick() const;
+  void process(std::uint64_t tick);
+  void arm();
+  void expire();
+};
+
+struct wheel_timer_t::data_t : public std::enable_shared_from_this<wheel_timer_t::data_t>
+{
+  timer_wheel_t::data_t::link_t link{this};
+  timer_wheel_t::data_t *wheel = nullptr;
+  std::function<void()> func;
+  std::uint64_t expires = 0;
+  // wheel_levels while waiting for dispatch
+  unsigned int level = 0;
+  unsigned int slot = 0;
+  bool pending = false;
+
+  ~data_t()
+  {
+    if(pending)
+      wheel->remove(this);
+  }
+};
+
+timer_wheel_t::data_t::~data_t()
+{
+  for(auto &level : slots)
+    for(auto &slot : level)
+      while(!slot.empty())
+      {
+        wheel_timer_t::data_t *timer = slot.next->timer;
+        slot.next->remove();
+        timer->pending = false;
+        timer->wheel = nullptr;
+      }
+}
+
+void timer_wheel_t::data_t::insert(wheel_timer_t::data_t *timer)
+{
+  timer->expires = std::max(timer->expires, current + 1);
+
+  // The level is chosen by the distance, the slot by the expiry itself.
+  std::uint64_t delta = timer->expires - current;
+  unsigned int level = 0;
+  while(level + 1 < wheel_levels && delta >= 1ULL << (wheel_bits * (level + 1)))
+    level++;
+  std::uint64_t expires = delta < wheel_range ? timer->expires : current + wheel_range - 1;
+
+  timer->level = level;
+  timer->slot = static_cast<unsigned int>((expires >> (wheel_bits * level)) & (wheel_slots - 1));
+  slots[level][timer->slot].push_back(&timer->link);
+  occupied[level] |= 1ULL << timer->slot;
+  timer->pending = true;
+  count++;
+}
+
+void timer_wheel_t::data_t::remove(wheel_timer_t::data_t *timer)
+{
+  timer->link.remove();
+  if(timer->level < wheel_levels && slots[timer->level][timer->slot].empty())
+    occupied[timer->level] &= ~(1ULL << timer->slot);
+  timer->pending = false;
+  count--;
+}
+
+// The next millisecond in which a slot is due, either for expiry in the first
+// level or for moving its timers down a level.
+std::uint64_t timer_wheel_t::data_t::next_tick() const
+{
+  std::uint64_t next = no_tick;
+  for(unsigned int level = 0; level < wheel_levels; level++)
+  {
+    if(!occupied[level])
+      continue;
+    unsigned int shift = wheel_bits * level;
+    auto index = static_cast<unsigned int>((current >> shift) & (wheel_slots - 1));
+    std::uint64_t base = (current >> (shift + wheel_bits)) << (shift + wheel_bits);
+    // Slots after the current one belong to this rotation, the others to the next.
+    std::uint64_t ahead = index + 1 < wheel_slots ? occupied[level] & (~0ULL << (index + 1)) : 0;
+    std::uint64_t tick = ahead ? base + (static_cast<std::uint64_t>(lowest_bit(ahead)) << shift)
+                               : base + (wheel_slots << shift) + (static_cast<std::uint64_t>(lowest_bit(occupied[level])) << shift);
+    next = std::min(next, tick);
+  }
+  return next;
+}
+
+void timer_wheel_t::data_t::process(std::uint64_t tick)
+{
+  current = tick;
+  link_t due;
+
+  auto index = static_cast<unsigned int>(tick & (wheel_slots - 1));
+  slots[0][index].move_to(due);
+  occupied[0] &= ~(1ULL << index);
+
+  // Move the timers of the slots starting now down, from the top level.
+  for(unsigned int level = wheel_levels - 1; level > 0; level--)
+  {
+    unsigned int shift = wheel_bits * level;
+    if(tick & ((1ULL << shift) - 1))
+      continue;
+    index = static_cast<unsigned int>((tick >> shift) & (wheel_slots - 1));
+    link_t moved;
+    slots[level][index].move_to(moved);
+    occupied[level] &= ~(1ULL << index);
+    while(!moved.empty())
+    {
+      wheel_timer_t::data_t *timer = moved.next->timer;
+      moved.next->remove();
+      if(timer->expires <= tick)
+        due.push_back(&timer->link);
+      else
+      {
+        count--;
+        insert(timer);
+      }
+    }
+  }
+
+  for(link_t *link = due.next; link != &due; link = link->next)
+    link->timer->level = wheel_levels;
+
+  while(!due.empty())
+  {
+    auto timer = due.next->timer->shared_from_this();
+    remove(timer.get());
+    try
+    {
+      timer->func();
+    }
+    catch(...)
+    {
+      // Dispatch the rest with the next expiry.
+      while(!due.empty())
+      {
+        wheel_timer_t::data_t *rest = due.next->timer;
+        remove(rest);
+        insert(rest);
+      }
+      throw;
+    }
+  }
+}
+
+void timer_wheel_t::data_t::arm()
+{
+  std::uint64_t next = next_tick();
+  if(next == no_tick || next >= armed)
+    return;
+  std::uint64_t time = now();
+  std::uint64_t delay = next > time ? next - time : 1;
+  armed = next;
+  source.timer_update(static_cast<int>(std::min<std::uint64_t>(delay, std::numeric_limits<int>::max())));
+}
+
+void timer_wheel_t::data_t::expire()
+{
+  armed = no_tick;
+  try
+  {
+    std::uint64_t time = now();
+    while(count)
+    {
+      std::uint64_t tick = next_tick();
+      if(tick > time)
+        break;
+      process(tick);
+    }
+    // Nothing is due in between.
+    current = std::max(current, time);
+  }
+  catch(...)
+  {
+    arm();
+    throw;
+  }
+  arm();
+}
+
+timer_wheel_t::timer_wheel_t(event_loop_t &event_loop)
+  : data(new data_t(event_loop))
+{
+}
+
+timer_wheel_t::~timer_wheel_t() noexcept = default;
+
+wheel_timer_t timer_wheel_t::add_timer(const std::function<void()> &func)
+{
+  auto timer = make_pooled<wheel_timer_t::data_t>();
+  timer->wheel = data.get();
+  timer->func = func;
+  return wheel_timer_t(timer);
+}
+
+std::size_t timer_wheel_t::pending() const
+{
+  return data->count;
+}
+
+wheel_timer_t::wheel_timer_t(std::shared_ptr<data_t> d)
+  : data(std::move(d))
+{
+}
+
+void wheel_timer_t::start(unsigned int ms_delay) const
+{
+  if(!data)
+    throw std::runtime_error("Timer is empty.");
+  if(!data->wheel)
+    throw std::runtime_error("Timer wheel has been destroyed.");
+  timer_wheel_t::data_t *wheel = data->wheel;
+  if(data->pending)
+    wheel->remove(data.get());
+  std::uint64_t now = wheel->now();
+  // Skip the time in which nothing was due, so the timer lands in a lower level.
+  if(wheel->next_tick() > now)
+    wheel->current = std::max(wheel->current, now);
+  data->expires = now + ms_delay;
+  wheel->insert(data.get());
+  wheel->arm();
+}
+
+void wheel_timer_t::stop() const
+{
+  if(data && data->pending)
+    data->wheel->remove(data.get());
+}
+
+bool wheel_timer_t::pending() const
+{
+  return data && data->pending;
+}
+
+wheel_timer_t::operator bool() const
+{
+  return static_cast<bool>(data);
+}
+
+//-----------------------------------------------------------------------------
+
+#ifdef WAYLANDPP_IO_URING
+
+namespace
+{
+  int io_uring_setup(unsigned int entries, io_uring_params *params)
+  {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+  }
+
+  int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+  {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+  }
+
+  std::uint32_t poll_events(std::uint32_t mask)
+  {
+    return (mask & WL_EVENT_READABLE ? POLLIN : 0U) | (mask & WL_EVENT_WRITABLE ? POLLOUT : 0U);
+  }
+
+  std::uint32_t event_mask(std::uint32_t events)
+  {
+    std::uint32_t mask = 0;
+    if(events & POLLIN)
+      mask |= WL_EVENT_READABLE;
+    if(events & POLLOUT)
+      mask |= WL_EVENT_WRITABLE;
+    if(events & POLLHUP)
+      mask |= WL_EVENT_HANGUP;
+    if(events & POLLERR)
+      mask |= WL_EVENT_ERROR;
+    return mask;
+  }
+
+  // multishot polls and poll updates arrived together with this feature
+  constexpr std::uint32_t required_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RSRC_TAGS;
+}
+
+struct io_uring_backend_t::data_t
+{
+  // A multishot poll. Its address is the user data of the poll and is only
+  // freed after the last completion.
+  struct poll_t : public wayland::detail::pooled_t
+  {
+    int fd = -1;
+    std::uint32_t mask = 0;
+    std::function<int(int, uint32_t)> func;
+    io_uring_source_t::data_t *source = nullptr;
+    poll_t *prev = nullptr;
+    poll_t *next = nullptr;
+    // the source still exists
+    bool active = true;
+    // the kernel may still post completions
+    bool armed = false;
+    // a completion reported an error, so it is not polled anymore
+    bool failed = false;
+    bool dispatching = false;
+    // the removal did not fit into the submission queue yet
+    bool remove_pending = false;
+  };
+
+  wl_event_loop *event_loop = nullptr;
+  int ring_fd = -1;
+  void *rings = nullptr;
+  std::size_t rings_size = 0;
+  io_uring_sqe *sqes = nullptr;
+  std::size_t sqes_size = 0;
+
+  unsigned int *sq_head = nullptr;
+  unsigned int *sq_tail = nullptr;
+  unsigned int *sq_array = nullptr;
+  unsigned int *sq_flags = nullptr;
+  unsigned int sq_mask = 0;
+  unsigned int sq_entries = 0;
+  unsigned int *cq_head = nullptr;
+  unsigned int *cq_tail = nullptr;
+  io_uring_cqe *cqes = nullptr;
+  unsigned int cq_mask = 0;
+
+  // written after the tail, but not yet submitted
+  unsigned int queued = 0;
+  wl_event_source *ring_source = nullptr;
+  wl_event_source *flush_idle = nullptr;
+  poll_t *polls = nullptr;
+  // some polls have remove_pending set
+  bool removals_pending = false;
+
+  data_t(wl_event_loop *loop, unsigned int entries);
+  ~data_t();
+
+  bool full() const;
+  io_uring_sqe *next();
+  io_uring_sqe *queue();
+  void submit();
+  void arm(poll_t *poll);
+  void update(poll_t *poll, std::uint32_t mask);
+  void queue_remove(poll_t *poll);
+  void remove(poll_t *poll) noexcept;
+  void queue_removals();
+  void release(poll_t *poll);
+  void complete(std::uint64_t user_data, std::int32_t res, std::uint32_t flags);
+  void process();
+
+  static int ring_func(int fd, uint32_t mask, void *data);
+  static void flush_func(void *data);
+};
+
+struct io_uring_source_t::data_t
+{
+  io_uring_backend_t::data_t *backend = nullptr;
+  io_uring_backend_t::data_t::poll_t *poll = nullptr;
+
+  ~data_t()
+  {
+    if(backend)
+      backend->remove(poll);
+  }
+};
+
+io_uring_backend_t::data_t::data_t(wl_event_loop *loop, unsigned int entries)
+  : event_loop(loop)
+{
+  io_uring_params params{};
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = 2 * entries;
+  ring_fd = io_uring_setup(entries, &params);
+  if(ring_fd < 0)
+    throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+  if((params.features & required_features) != required_features)
+  {
+    close(ring_fd);
+    throw std::runtime_error("io_uring is too old, Linux 5.13 is required.");
+  }
+
+  // With IORING_FEAT_SINGLE_MMAP, both rings share one mapping.
+  rings_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+                        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+  rings = mmap(nullptr, rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if(rings == MAP_FAILED)
+  {
+    int error = errno;
+    close(ring_fd);
+    throw std::system_error(error, std::generic_category(), "mmap");
+  }
+  sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if(sqes_map == MAP_FAILED)
+  {
+    int error = errno;
+    munmap(rings, rings_size);
+    close(ring_fd);
+    throw std::system_error(error, std::generic_category(), "mmap");
+  }
+  sqes = static_cast<io_uring_sqe*>(sqes_map);
+
+  auto *base = static_cast<char*>(rings);
+  sq_head = reinterpret_cast<unsigned int*>(base + params.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned int*>(base + params.sq_off.tail);
+  sq_array = reinterpret_cast<unsigned int*>(base + params.sq_off.array);
+  sq_flags = reinterpret_cast<unsigned int*>(base + params.sq_off.flags);
+  sq_mask = *reinterpret_cast<unsigned int*>(base + params.sq_off.ring_mask);
+  sq_entries = params.sq_entries;
+  cq_head = reinterpret_cast<unsigned int*>(base + params.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned int*>(base + params.cq_off.tail);
+  cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+  cq_mask = *reinterpret_cast<unsigned int*>(base + params.cq_off.ring_mask);
+
+  ring_source = wl_event_loop_add_fd(event_loop, ring_fd, WL_EVENT_READABLE, ring_func, this);
+  if(!ring_source)
+  {
+    munmap(sqes, sqes_size);
+    munmap(rings, rings_size);
+    close(ring_fd);
+    throw std::runtime_error("Failed to add io_uring to the event loop.");
+  }
+}
+
+io_uring_backend_t::data_t::~data_t()
+{
+  if(flush_idle)
+    wl_event_source_remove(flush_idle);
+  wl_event_source_remove(ring_source);
+  // Closing the ring cancels all polls.
+  munmap(sqes, sqes_size);
+  munmap(rings, rings_size);
+  close(ring_fd);
+  while(polls)
+  {
+    poll_t *poll = polls;
+    polls = poll->next;
+    if(poll->source)
+      poll->source->backend = nullptr;
+    delete poll;
+  }
+}
+
+bool io_uring_backend_t::data_t::full() const
+{
+  return *sq_tail + queued - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries;
+}
+
+io_uring_sqe *io_uring_backend_t::data_t::queue()
+{
+  if(full())
+    submit();
+  return next();
+}
+
+io_uring_sqe *io_uring_backend_t::data_t::next()
+{
+  unsigned int index = (*sq_tail + queued) & sq_mask;
+  io_uring_sqe *sqe = &sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array[index] = index;
+  queued++;
+
+  // Submit everything queued before the event loop goes to sleep.
+  if(!flush_idle)
+    flush_idle = wl_event_loop_add_idle(event_loop, flush_func, this);
+  return sqe;
+}
+
+void io_uring_backend_t::data_t::submit()
+{
+  if(!queued)
+    return;
+  // Publish the entries written by queue().
+  unsigned int count = queued;
+  __atomic_store_n(sq_tail, *sq_tail + count, __ATOMIC_RELEASE);
+  queued = 0;
+  unsigned int submitted = 0;
+  while(submitted < count)
+  {
+    int result = io_uring_enter(ring_fd, count - submitted, 0, 0);
+    if(result < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      // the completion queue is full, dispatch before trying again
+      if(errno == EBUSY || errno == EAGAIN)
+      {
+        process();
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+    }
+    submitted += static_cast<unsigned int>(result);
+  }
+}
+
+void io_uring_backend_t::data_t::arm(poll_t *poll)
+{
+  io_uring_sqe *sqe = queue();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = poll->fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = poll_events(poll->mask);
+  sqe->user_data = reinterpret_cast<std::uintptr_t>(poll);
+  poll->armed = true;
+}
+
+void io_uring_backend_t::data_t::update(poll_t *poll, std::uint32_t mask)
+{
+  poll->mask = mask;
+  if(!poll->armed)
+    return;
+  io_uring_sqe *sqe = queue();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+  sqe->addr = reinterpret_cast<std::uintptr_t>(poll);
+  sqe->poll32_events = poll_events(mask);
+}
+
+void io_uring_backend_t::data_t::queue_remove(poll_t *poll)
+{
+  io_uring_sqe *sqe = next();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<std::uintptr_t>(poll);
+}
+
+void io_uring_backend_t::data_t::remove(poll_t *poll) noexcept
+{
+  poll->active = false;
+  poll->source = nullptr;
+  if(poll->armed)
+  {
+    // This runs in the destructor of the source, so it must neither submit,
+    // which may fail or dispatch other sources, nor throw. A removal that
+    // does not fit is queued by the next flush instead.
+    if(full())
+    {
+      poll->remove_pending = true;
+      removals_pending = true;
+      if(!flush_idle)
+        flush_idle = wl_event_loop_add_idle(event_loop, flush_func, this);
+    }
+    else
+      queue_remove(poll);
+  }
+  else if(!poll->dispatching)
+    release(poll);
+}
+
+void io_uring_backend_t::data_t::queue_removals()
+{
+  while(removals_pending)
+  {
+    removals_pending = false;
+    for(poll_t *poll = polls; poll; poll = poll->next)
+    {
+      if(!poll->remove_pending)
+        continue;
+      if(full())
+      {
+        // Submitting may release polls, so the list is walked again.
+        removals_pending = true;
+        break;
+      }
+      poll->remove_pending = false;
+      queue_remove(poll);
+    }
+    if(removals_pending)
+      submit();
+  }
+}
+
+void io_uring_backend_t::data_t::release(poll_t *poll)
+{
+  if(poll->prev)
+    poll->prev->next = poll->next;
+  else
+    polls = poll->next;
+  if(poll->next)
+    poll->next->prev = poll->prev;
+  delete poll;
+}
+
+void io_uring_backend_t::data_t::complete(std::uint64_t user_data, std::int32_t res, std::uint32_t flags)
+{
+  // results of updates and removals
+  if(!user_data)
+    return;
+
+  auto *poll = reinterpret_cast<poll_t*>(static_cast<std::uintptr_t>(user_data));
+  if(!(flags & IORING_CQE_F_MORE))
+    poll->armed = false;
+
+  if(poll->active && res != -ECANCELED)
+  {
+    if(res < 0)
+      poll->failed = true;
+    poll->dispatching = true;
+    try
+    {
+      poll->func(poll->fd, res < 0 ? static_cast<std::uint32_t>(WL_EVENT_ERROR) : event_mask(static_cast<std::uint32_t>(res)));
+    }
+    catch(...)
+    {
+      poll->dispatching = false;
+      if(!poll->active && !poll->armed)
+        release(poll);
+      else if(poll->active && !poll->armed && !poll->failed)
+        arm(poll);
+      throw;
+    }
+    poll->dispatching = false;
+  }
+
+  if(!poll->armed)
+  {
+    if(!poll->active)
+      release(poll);
+    else if(!poll->failed)
+      arm(poll);
+  }
+}
+
+void io_uring_backend_t::data_t::process()
+{
+  while(true)
+  {
+    // The head is read again for every entry, because a callback may submit
+    // and thereby process completions itself.
+    unsigned int head;
+    while((head = *cq_head) != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+      io_uring_cqe cqe = cqes[head & cq_mask];
+      // Release the entry before dispatching, which may throw.
+      __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+      complete(cqe.user_data, cqe.res, cqe.flags);
+    }
+
+    // Completions that did not fit into the queue are kept by the kernel
+    // until they are asked for.
+    if(!(__atomic_load_n(sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW))
+      break;
+    if(io_uring_enter(ring_fd, 0, 0, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+      throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+  }
+}
+
+int io_uring_backend_t::data_t::ring_func(int /*fd*/, uint32_t /*mask*/, void *data)
+{
+  auto *d = static_cast<data_t*>(data);
+  d->process();
+  d->queue_removals();
+  d->submit();
+  return 0;
+}
+
+void io_uring_backend_t::data_t::flush_func(void *data)
+{
+  auto *d = static_cast<data_t*>(data);
+  // libwayland removes the idle source after this call.
+  d->flush_idle = nullptr;
+  d->queue_removals();
+  d->submit();
+}
+
+bool io_uring_backend_t::available()
+{
+  io_uring_params params{};
+  int fd = io_uring_setup(1, &params);
+  if(fd < 0)
+    return false;
+  close(fd);
+  return (params.features & required_features) == required_features;
+}
+
+io_uring_backend_t::io_uring_backend_t(event_loop_t &event_loop, unsigned int entries)
+  : data(new data_t(event_loop.c_ptr(), entries))
+{
+}
+
+io_uring_source_t io_uring_backend_t::add_fd(int fd, const fd_event_mask_t& mask, const std::function<int(int, uint32_t)> &func)
+{
+  auto source = make_pooled<io_uring_source_t::data_t>();
+  auto *poll = new data_t::poll_t;
+  poll->fd = fd;
+  poll->mask = mask;
+  poll->func = func;
+  poll->source = source.get();
+  poll->next = data->polls;
+  if(poll->next)
+    poll->next->prev = poll;
+  data->polls = poll;
+  source->backend = data.get();
+  source->poll = poll;
+  data->arm(poll);
+  return io_uring_source_t(source);
+}
+
+void io_uring_source_t::fd_update(const fd_event_mask_t& mask) const
+{
+  if(data && data->backend)
+    data->backend->update(data->poll, mask);
+}
+
+#else
+
+struct io_uring_backend_t::data_t
+{
+};
+
+struct io_uring_source_t::data_t
+{
+};
+
+bool io_uring_backend_t::available()
+{
+  return false;
+}
+
+io_uring_backend_t::io_uring_backend_t(event_loop_t &/*event_loop*/, unsigned int /*entries*/)
+{
+  throw std::runtime_error("The library was built without io_uring support.");
+}
+
+io_uring_source_t io_uring_backend_t::add_fd(int /*fd*/, const fd_event_mask_t& /*mask*/, const std::function<int(int, uint32_t)> &/*func*/)
+{
+  throw std::runtime_error("The library was built without io_uring support.");
+}
+
+void io_uring_source_t::fd_update(const fd_event_mask_t& /*mask*/) const
+{
+}
+
+#endif
+
+io_uring_backend_t::~io_uring_backend_t() noexcept = default;
+
+io_uring_source_t::io_uring_source_t(std::shared_ptr<data_t> d)
+  : data(std::move(d))
+{
+}
+
+io_uring_source_t::operator bool() const
+{
+  return static_cast<bool>(data);
+}
+
+//-----------------------------------------------------------------------------
+
+backpressure_t::backpressure_t(display_t &display, std::size_t high_water, std::size_t low_water)
+  : data(std::make_shared<backpressure_data_t>())
+{
+  if(low_water > high_water)
+    throw std::invalid_argument("The low-water mark must not be above the high-water mark.");
+  data->display = display.c_ptr();
+  data->high_water = high_water;
+  data->low_water = low_water;
+}
+
+backpressure_t::~backpressure_t() noexcept
+{
+  wl_client *c = nullptr;
+  wl_client_for_each(c, wl_display_get_client_list(data->display))
+  {
+    client_t client(c);
+    if(client.data->backpressure == data)
+    {
+      client.data->backpressure.reset();
+      client.data->drop_events = false;
+    }
+  }
+}
+
+void backpressure_t::add_droppable_event(const std::string &interface_name, const std::string &event_name)
+{
+  data->droppable_events.emplace_back(interface_name, event_name);
+  data->droppable_masks.clear();
+}
+
+void backpressure_t::check()
+{
+  std::vector<wl_client*> disconnect;
+  wl_client *c = nullptr;
+  wl_client_for_each(c, wl_display_get_client_list(data->display))
+  {
+    client_t client(c);
+    std::size_t size = 0;
+    if(!output_queue_size(client.get_fd(), size))
+      continue;
+
+    if(!client.data->backpressure)
+    {
+      if(size < data->high_water)
+        continue;
+      backpressure_action_t action = backpressure_action_t::keep;
+      if(data->high_water_func)
+        action = data->high_water_func(client, size);
+      if(action == backpressure_action_t::disconnect)
+      {
+        disconnect.push_back(c);
+        continue;
+      }
+      client.data->backpressure = data;
+      client.data->drop_events = action == backpressure_action_t::drop;
+    }
+    else if(client.data->backpressure == data && size <= data->low_water)
+    {
+      client.data->backpressure.reset();
+      client.data->drop_events = false;
+      if(data->low_water_func)
+        data->low_water_func(client, size);
+    }
+  }
+
+  // Destroying a client unlinks it from the list, so this is done last.
+  for(wl_client *client : disconnect)
+    wl_client_destroy(client);
+}
+
+std::function<backpressure_action_t(client_t&, std::size_t)> &backpressure_t::on_high_water()
+{
+  return data->high_water_func;
+}
+
+std::function<void(client_t&, std::size_t)> &backpressure_t::on_low_water()
+{
+  return data->low_water_func;
+}
@@ -25,23 +25,197 @@
 
 #include <wayland-util.hpp>
 
+#include <array>
+#include <cctype>
 #include <cerrno>
 #include <limits>
+#include <mutex>
 #include <system_error>
+#include <unordered_map>
 
 using namespace wayland;
 using namespace wayland::detail;
 
+namespace
+{
+  // Blocks are recycled in size classes of pool_granularity bytes. Larger
+  // requests go straight to the global allocator.
+  constexpr std::size_t pool_granularity = 16;
+  constexpr std::size_t pool_classes = 32;
+  // Upper bound for the number of cached blocks per size class and thread
+  constexpr std::size_t pool_capacity = 256;
+
+  struct free_block_t
+  {
+    free_block_t *next;
+  };
+
+  // Set once the pool of the thread is gone, objects destroyed afterwards
+  // (e.g. from static destructors) are freed directly.
+  thread_local bool pool_destroyed = false;
+
+  class thread_pool_t
+  {
+  private:
+    std::array<free_block_t*, pool_classes> heads{};
+    std::array<std::size_t, pool_classes> counts{};
+
+  public:
+    thread_pool_t() = default;
+    thread_pool_t(const thread_pool_t&) = delete;
+    thread_pool_t &operator=(const thread_pool_t&) = delete;
+
+    ~thread_pool_t()
+    {
+      pool_destroyed = true;
+      for(auto *head : heads)
+        while(head)
+        {
+          free_block_t *next = head->next;
+          ::operator delete(head);
+          head = next;
+        }
+    }
+
+    void *allocate(std::size_t cls)
+    {
+      free_block_t *block = heads[cls];
+      if(!block)
+        return ::operator new((cls + 1) * pool_granularity);
+      heads[cls] = block->next;
+      counts[cls]--;
+      return block;
+    }
+
+    void deallocate(void *ptr, std::size_t cls) noexcept
+    {
+      if(counts[cls] == pool_capacity)
+      {
+        ::operator delete(ptr);
+        return;
+      }
+      auto *block = static_cast<free_block_t*>(ptr);
+      block->next = heads[cls];
+      heads[cls] = block;
+      counts[cls]++;
+    }
+  };
+
+  thread_pool_t &thread_pool()
+  {
+    thread_local thread_pool_t pool;
+    return pool;
+  }
+
+  std::size_t size_class(std::size_t size)
+  {
+    return size == 0 ? 0 : (size - 1) / pool_granularity;
+  }
+
+  void *pool_allocate(std::size_t size)
+  {
+    std::size_t cls = size_class(size);
+    if(cls >= pool_classes)
+      return ::operator new(size);
+    // Blocks may be freed into the pool of another thread, so they always
+    // have the full size of their class.
+    if(pool_destroyed)
+      return ::operator new((cls + 1) * pool_granularity);
+    return thread_pool().allocate(cls);
+  }
+
+  void pool_deallocate(void *ptr, std::size_t size) noexcept
+  {
+    std::size_t cls = size_class(size);
+    if(cls >= pool_classes || pool_destroyed)
+      ::operator delete(ptr);
+    else
+      thread_pool().deallocate(ptr, cls);
+  }
+
+  object_allocator_t object_allocator{pool_allocate, pool_deallocate};
+}
+
 namespace wayland
 {
+  void set_object_allocator(const object_allocator_t &allocator)
+  {
+    if(!allocator.allocate || !allocator.deallocate)
+      throw std::invalid_argument("Incomplete object allocator.");
+    object_allocator = allocator;
+  }
+
+  object_allocator_t default_object_allocator()
+  {
+    return {pool_allocate, pool_deallocate};
+  }
+
   namespace detail
   {
+    void *allocate_object(std::size_t size)
+    {
+      return object_allocator.allocate(size);
+    }
+
+    void deallocate_object(void *ptr, std::size_t size) noexcept
+    {
+      if(ptr)
+        object_allocator.deallocate(ptr, size);
+    }
+
     int check_return_value(int return_value, const std::string &function_name)
     {
       if(return_value < 0)
         throw std::system_error(errno, std::generic_category(), function_name);
       return return_value;
     }
+
+    std::size_t &refcount_t::operations() noexcept
+    {
+      thread_local std::size_t operations = 0;
+      return operations;
+    }
+
+    const message_signature_t &message_signature(const wl_message *message)
+    {
+      // Messages are static data, so their decoded form never has to be invalidated.
+      // The table is shared by all threads and entries are never erased, so the
+      // returned references stay valid after the lock is released.
+      static std::mutex mutex;
+      static std::unordered_map<const wl_message*, message_signature_t> table;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = table.find(message);
+        if(it != table.end())
+          return it->second;
+      }
+
+      message_signature_t signature;
+      std::uint32_t since = 0;
+      bool nullable = false;
+      for(const char *ch = message->signature; *ch; ch++)
+      {
+        if(std::isdigit(*ch))
+          since = since * 10 + static_cast<std::uint32_t>(*ch - '0');
+        else if(*ch == '?')
+          nullable = true;
+        else
+        {
+          signature.arguments.push_back({*ch, nullable});
+          if(*ch == 'n')
+            signature.has_new_id = true;
+          nullable = false;
+        }
+      }
+      if(since > 0)
+        signature.since = since;
+
+      // Another thread may have decoded the same message in the meantime, in
+      // which case its entry is kept
+      std::lock_guard<std::mutex> lock(mutex);
+      return table.emplace(message, std::move(signature)).first->second;
+    }
   }
 }
 
@@ -138,6 +312,13 @@ wl_argument argument_t::get_c_argument() const
   return argument;
 }
 
+wl_argument wayland::detail::wire_argument(const array_t &arr)
+{
+  wl_argument a;
+  a.a = const_cast<wl_array*>(&arr.a);
+  return a;
+}
+
 array_t::array_t(wl_array *arr)
 {
   wl_array_init(&a);